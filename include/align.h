@@ -2,13 +2,20 @@
 
 #include "io.h"
 #include "matrix.h"
+#include "bit_mask.h"
 
 Image gray_world(Image src_image);
 
-Image resize(Image src_image, double scale);
+// Resize and canny work both on Image and on single planes (Plane8),
+// resize also works on 16-bit planes (Plane16).
+template <typename PixelT>
+Matrix<PixelT> resize(const Matrix<PixelT>& src_image, double scale);
 
-Image bicubicResize(Image srcImage, double scale);
+template <typename PixelT>
+Matrix<PixelT> bicubicResize(const Matrix<PixelT>& srcImage, double scale);
 
 Image autocontrast(Image src_image, double fraction);
 
-Image canny(Image src_image, int threshold1, int threshold2);
+// Edge map of image: set pixels are edges.
+template <typename PixelT>
+BitMask canny(const Matrix<PixelT>& src_image, int threshold1, int threshold2);
@@ -1,18 +1,29 @@
 #pragma once
 
 #include "align.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <mutex>
+#include <type_traits>
 #include <vector>
 #include <numeric>
 #include <initializer_list>
 
-Image cropImage(const Image& src_image, int threshold1, int threshold2, size_t countRows, size_t countColumns, size_t cntNullable);
+// Alignment functions work on Image (only first channel is used)
+// and on single 8-bit planes (Plane8). Crop by simpleCropImage, pyramid,
+// shift search and merge work on 16-bit planes (Plane16) as well.
 
-Image simpleCropImage(const Image& im, double rowsDiscared, double colsDiscared);
+template <typename PixelT>
+Matrix<PixelT> cropImage(const Matrix<PixelT>& src_image, int threshold1, int threshold2, size_t countRows, size_t countColumns, size_t cntNullable);
 
-std::vector<Image> getImagesPyramid(const Image& srcImage, double k, size_t minLen, bool isInterp);
+template <typename PixelT>
+Matrix<PixelT> simpleCropImage(const Matrix<PixelT>& im, double rowsDiscared, double colsDiscared);
 
-template <typename Func>
-static std::pair<int, int> getBestShiftForPyramids(const std::vector<Image>& pyramid1, const std::vector<Image>& pyramid2,
+template <typename PixelT>
+std::vector<Matrix<PixelT>> getImagesPyramid(const Matrix<PixelT>& srcImage, double k, size_t minLen, bool isInterp);
+
+template <typename ImageT, typename Func>
+static std::pair<int, int> getBestShiftForPyramids(const std::vector<ImageT>& pyramid1, const std::vector<ImageT>& pyramid2,
         Func getBestShiftFor2, int maxShiftBegin, int maxShiftCorr, double k)
 {
     if (pyramid1.empty() || pyramid2.empty())
@@ -31,7 +42,24 @@ static std::pair<int, int> getBestShiftForPyramids(const std::vector<Image>& pyr
     return bestShift;
 }
 
-std::vector<Image> divideImageOnChannels(const Image &image);
+// Split plate on three equal (up to one row) parts from top to bottom.
+// Returned images are submatrices of source image.
+template <typename PixelT>
+std::vector<Matrix<PixelT>> divideImageOnChannels(const Matrix<PixelT> &image) {
+    std::vector<Matrix<PixelT>> images;
+    size_t current_row = 0;
+    for (int i = 0; i < 3; ++i) {
+        size_t current_height = (image.n_rows - current_row) / (3 - i);
+        images.push_back(image.submatrix(current_row, 0, current_height, image.n_cols));
+        current_row += current_height;
+    }
+    return images;
+}
+
+// Same as divideImageOnChannels(load_plane(path)) for BMP file, but thirds
+// of plate are read from file separately and in parallel. Files, which only
+// EasyBMP reads, are decoded once and split.
+std::vector<Plane8> loadPlateChannels(const char* path);
 
 struct CrossImageResult {
     size_t up, left, height, width;
@@ -41,58 +69,146 @@ CrossImageResult crossImagesImpl(const std::pair<size_t, size_t>& baseImage,
                                  std::initializer_list<std::pair<size_t, size_t>> imagesSize,
                                  std::initializer_list<std::pair<int, int>> shifts);
 
-CrossImageResult crossImages(const Image& image1, const Image& image2, int rowShift, int colShift);
+template <typename PixelT>
+CrossImageResult crossImages(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, int rowShift, int colShift) {
+    return crossImagesImpl({image1.n_rows, image1.n_cols}, {{image2.n_rows, image2.n_cols}}, {{rowShift, colShift}});
+}
 
-CrossImageResult crossImages(const Image& image1, const Image& image2, const Image& image3,
-                             int rowShift2, int colShift2, int rowShift3, int colShift3);
+template <typename PixelT>
+CrossImageResult crossImages(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, const Matrix<PixelT>& image3,
+                             int rowShift2, int colShift2, int rowShift3, int colShift3) {
+    return crossImagesImpl({size_t(image1.n_rows), size_t(image1.n_cols)},
+                           {{size_t(image2.n_rows), size_t(image2.n_cols)}, {size_t(image3.n_rows), size_t(image3.n_cols)}},
+                           {{rowShift2, colShift2}, {rowShift3, colShift3}});
+}
 
-template <typename Func>
-unsigned long long calculateSum(const Image& image1, const Image& image2, int rowShift, int colShift, Func func) {
-    auto cross = crossImages(image1, image2, rowShift, colShift);
+// Same as calculateSum below, but cross of images is already known.
+template <typename PixelT, typename Func>
+unsigned long long calculateSum(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, const CrossImageResult& cross,
+                                int rowShift, int colShift, Func func) {
     unsigned long long res = 0;
 
-    for (size_t r1 = cross.up, r2 = r1 - rowShift; r1 < image1.n_rows && r2 < image2.n_rows; ++r1, ++r2) {
-        for (size_t c1 = cross.left, c2 = c1 - colShift; c1 < image1.n_cols && c2 < image2.n_cols; ++c1, ++c2) {
-            res += func(std::get<0>(image1(r1, c1)), std::get<0>(image2(r2, c2)));
-        }
+    for (size_t r1 = cross.up, r2 = r1 - rowShift; r1 < cross.up + cross.height; ++r1, ++r2) {
+        const PixelT* row1 = image1.row_ptr(r1) + cross.left;
+        const PixelT* row2 = image2.row_ptr(r2) + (cross.left - colShift);
+        for (size_t c = 0; c < cross.width; ++c)
+            res += func(channelValue(row1[c]), channelValue(row2[c]));
     }
 
     return res;
 }
 
-long double calculateMSE(const Image& image1, const Image& image2, int rowShift, int colShift);
+template <typename PixelT, typename Func>
+unsigned long long calculateSum(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, int rowShift, int colShift, Func func) {
+    return calculateSum(image1, image2, crossImages(image1, image2, rowShift, colShift), rowShift, colShift, func);
+}
+
+template <typename PixelT>
+long double calculateMSE(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, int rowShift, int colShift);
 
-unsigned long long calculateCrossCorrelation(const Image& image1, const Image& image2, int rowShift, int colShift);
+template <typename PixelT>
+unsigned long long calculateCrossCorrelation(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, int rowShift, int colShift);
 
 enum class ActionType {
     MINIMIZE, MAXIMIZE
 };
 
+// Shift from [minRowShift, maxRowShift] x [minColShift, maxColShift] with the
+// best value of key(dRow, dCol). Shifts are evaluated in parallel by bands
+// on the global thread pool, so key must be safe to call concurrently.
+// Of equal values the first one in row-major order wins, as in sequential
+// search, so result doesn't depend on the number of threads.
 template <typename KeyFunc>
 std::pair<int, int> getBestShiftImpl(int minRowShift, int maxRowShift, int minColShift, int maxColShift, KeyFunc key, ActionType action) {
-    int bestDRow = minRowShift;
-    int bestDCol = minColShift;
-    unsigned long long bestVal = action == ActionType::MINIMIZE ? std::numeric_limits<unsigned long long>::max() : 0;
-
-    for (int dRow = minRowShift; dRow <= maxRowShift; ++dRow) {
-        for (int dCol = minColShift; dCol <= maxColShift; ++dCol) {
-            auto curVal = key(dRow, dCol);
-            if ((action == ActionType::MINIMIZE && curVal < bestVal) || (action == ActionType::MAXIMIZE && curVal > bestVal)) {
-                bestVal = curVal;
-                bestDRow = dRow;
-                bestDCol = dCol;
-            }
+    // values are kept in the type of key, so fractional MSE is not truncated
+    // and negative scores of signed keys are not wrapped.
+    typedef typename std::decay<decltype(key(0, 0))>::type ValueT;
+    struct Candidate {
+        size_t index;
+        ValueT value;
+    };
+
+    if (maxRowShift < minRowShift || maxColShift < minColShift)
+        return {minRowShift, minColShift};
+    const size_t colShifts = maxColShift - minColShift + 1;
+    const size_t count = (maxRowShift - minRowShift + 1) * colShifts;
+    auto evaluate = [&] (size_t index) {
+        const Candidate res = {index, key(minRowShift + static_cast<int>(index / colShifts), minColShift + static_cast<int>(index % colShifts))};
+        return res;
+    };
+    auto better = [action] (const Candidate& candidate, const Candidate& best) {
+        return action == ActionType::MINIMIZE ? candidate.value < best.value : candidate.value > best.value;
+    };
+
+    std::vector<Candidate> bandBests;
+    std::mutex mutex;
+    ThreadPool::global().parallelFor(0, count, 1, [&] (size_t begin, size_t end) {
+        Candidate best = evaluate(begin);
+        for (size_t index = begin + 1; index < end; ++index) {
+            const Candidate candidate = evaluate(index);
+            if (better(candidate, best))
+                best = candidate;
         }
+        std::lock_guard<std::mutex> lock(mutex);
+        bandBests.push_back(best);
+    });
+
+    // bands are merged in row-major order, so ties are broken as in sequential search.
+    std::sort(bandBests.begin(), bandBests.end(), [] (const Candidate& lhs, const Candidate& rhs) {
+        return lhs.index < rhs.index;
+    });
+    Candidate best = bandBests.front();
+    for (const Candidate& candidate : bandBests) {
+        if (better(candidate, best))
+            best = candidate;
     }
-    return {bestDRow, bestDCol};
+    return {minRowShift + static_cast<int>(best.index / colShifts), minColShift + static_cast<int>(best.index % colShifts)};
 }
 
-std::pair<int, int> getBestShiftByMSE(const Image& image1, const Image& image2,
+template <typename PixelT>
+std::pair<int, int> getBestShiftByMSE(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
         int minRowShift, int maxRowShift, int minColShift, int maxColShift);
 
-std::pair<int, int> getBestShiftByCrossCorrelation(const Image& image1, const Image& image2,
+// Same result as getBestShiftByMSE, but by branch and bound: shifts are
+// visited in rings of growing distance from the center of the window (the
+// shift predicted by previous pyramid level), and sum of squared differences
+// of a shift is abandoned, once its partial sum over the overlap area is
+// already greater than the best MSE found. Ties are broken in row-major
+// order, as in exhaustive search.
+template <typename PixelT>
+std::pair<int, int> getBestShiftByBoundedMSE(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
+        int minRowShift, int maxRowShift, int minColShift, int maxColShift);
+
+template <typename PixelT>
+std::pair<int, int> getBestShiftByCrossCorrelation(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
+        int minRowShift, int maxRowShift, int minColShift, int maxColShift);
+
+// Shift of image2 relative to image1 by phase correlation: peak of inverse
+// transform of normalized cross-power spectrum within the window of
+// shifts. Costs O(N log N) for any window, unlike MSE search.
+template <typename PixelT>
+std::pair<int, int> getBestShiftByPhaseCorrelation(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
         int minRowShift, int maxRowShift, int minColShift, int maxColShift);
 
 // GBR
 Image mergeImages(const Image& imageBase, const Image& image1, const Image& image2,
                   const std::pair<int, int>& shif1, const std::pair<int, int>& shift2);
+
+// Same, but channels are planes and result is planar image.
+template <typename ChannelT>
+PlanarImage<ChannelT> mergeImages(const Matrix<ChannelT>& imageBase, const Matrix<ChannelT>& image1, const Matrix<ChannelT>& image2,
+                                  const std::pair<int, int>& shif1, const std::pair<int, int>& shift2);
+
+// Shifts of red (shift2) and blue (shift0) channels relative to green one.
+struct PlateShifts {
+    std::pair<int, int> shift0, shift2;
+};
+
+// Aligns plate from BMP file srcPath and writes result to dstPath without
+// holding whole plate in memory. Pipeline is the same as for big plates
+// in memory (simple crop, pyramid with scale 0.5 and bilinear resize, MSE),
+// so result is the same as well. Pyramid levels of at most bandPixels
+// pixels are held in memory, bigger levels and the merge are streamed
+// through bands of about bandPixels pixels. Result is always written as
+// BMP, TIFF dstPath is rejected.
+PlateShifts alignPlateStreaming(const char* srcPath, const char* dstPath, size_t bandPixels = 1 << 22);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "matrix.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Binary image (like edge map), 64 pixels are packed in one word.
+// Compared to Image it takes one bit per pixel instead of 12 bytes,
+// and counting of set pixels in a row is one popcount per 64 pixels.
+//
+// BitMask edges(rows, cols);
+// edges.set(row, col, true);
+// size_t onRow = edges.countRow(row);
+class BitMask {
+public:
+    static const uint bitsPerWord = 64;
+
+    BitMask(uint row_count = 0, uint col_count = 0)
+        : cols(col_count), words(row_count, (col_count + bitsPerWord - 1) / bitsPerWord) {}
+
+    uint n_rows() const {
+        return words.n_rows;
+    }
+
+    uint n_cols() const {
+        return cols;
+    }
+
+    bool operator () (uint row, uint col) const {
+        check(row, col);
+        return (words.row_ptr(row)[col / bitsPerWord] >> (col % bitsPerWord)) & 1;
+    }
+
+    void set(uint row, uint col, bool value) {
+        check(row, col);
+        uint64_t& word = words.row_ptr(row)[col / bitsPerWord];
+        const uint64_t bit = uint64_t(1) << (col % bitsPerWord);
+        word = value ? word | bit : word & ~bit;
+    }
+
+    // Packed pixels of row: pixel col is bit (col % 64) of word (col / 64),
+    // bits after last column are zero.
+    const uint64_t* row_words(uint row) const {
+        return words.row_ptr(row);
+    }
+
+    uint64_t* row_words(uint row) {
+        return words.row_ptr(row);
+    }
+
+    // Number of set pixels in row.
+    size_t countRow(uint row) const {
+        if (row >= n_rows())
+            throw std::string("Out of bounds");
+        const uint64_t* src = words.row_ptr(row);
+        size_t res = 0;
+        for (uint i = 0; i < words.n_cols; ++i)
+            res += __builtin_popcountll(src[i]);
+        return res;
+    }
+
+    // Number of set pixels in column.
+    size_t countColumn(uint col) const {
+        if (col >= cols)
+            throw std::string("Out of bounds");
+        const uint word = col / bitsPerWord, shift = col % bitsPerWord;
+        size_t res = 0;
+        for (uint row = 0; row < n_rows(); ++row)
+            res += (words.row_ptr(row)[word] >> shift) & 1;
+        return res;
+    }
+
+    // Number of set pixels in whole mask.
+    size_t count() const {
+        size_t res = 0;
+        for (uint row = 0; row < n_rows(); ++row)
+            res += countRow(row);
+        return res;
+    }
+
+private:
+    uint cols;
+    // n_rows x (number of words in row).
+    Matrix<uint64_t> words;
+
+    void check(uint row, uint col) const {
+        if (row >= n_rows() || col >= cols)
+            throw std::string("Out of bounds");
+    }
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include <sys/mman.h>
+
+// Cache of big memory buffers, Matrix takes its storage from here.
+//
+// Image pipeline allocates and frees many buffers of full frame size
+// (channels, pyramid levels, filter intermediates). Freed buffer is kept
+// in the list of its size class and given to the next allocation of that
+// class, so frames don't page-fault fresh memory every time. Classes are
+// quarter-octave steps (64K, 80K, 96K, 112K, 128K, 160K, ...), so block
+// is at most a quarter bigger than requested. Small buffers are just
+// allocated with new.
+//
+// By default no more than defaultMaxCachedBytes of freed buffers are kept,
+// jobs set their own limit by setMaxCachedBytes (e.g. to their working set).
+//
+// With huge pages enabled, buffers of at least hugePageSize bytes are
+// mapped with mmap and advised to be backed by transparent huge pages.
+class BufferPool {
+public:
+    // Buffers smaller than that are not pooled.
+    static const size_t minPooledBytes = 64 * 1024;
+    static const size_t hugePageSize = 2 * 1024 * 1024;
+    // A few planes of big plate.
+    static const size_t defaultMaxCachedBytes = 128 * 1024 * 1024;
+
+    explicit BufferPool(size_t maxCachedBytes_ = defaultMaxCachedBytes)
+        : freeBlocks(), mutex(), cachedBytes_(0), maxCachedBytes(maxCachedBytes_), hugePages(false) {}
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator = (const BufferPool&) = delete;
+
+    ~BufferPool() {
+        trim();
+    }
+
+    // Pool used by all matrices. It is never destroyed, so matrices
+    // living in static variables can return their buffers at exit.
+    static BufferPool& global() {
+        static BufferPool* pool = new BufferPool();
+        return *pool;
+    }
+
+    // Array of count value-initialized elements. Memory goes back
+    // to the pool when last copy of pointer dies. With zeroed = false
+    // elements of trivial type are left as they are (like new T[count]),
+    // for buffers, which caller overwrites completely anyway.
+    template <typename T>
+    std::shared_ptr<T> allocate(size_t count, bool zeroed = true) {
+        if (count == 0)
+            return std::shared_ptr<T>();
+        Block block = acquire(count * sizeof(T));
+        T* data = static_cast<T*>(block.ptr);
+        if (std::is_trivial<T>::value) {
+            if (zeroed)
+                std::memset(block.ptr, 0, count * sizeof(T));
+        } else {
+            size_t constructed = 0;
+            try {
+                for (; constructed < count; ++constructed)
+                    new (data + constructed) T();
+            } catch (...) {
+                destroy(data, constructed);
+                release(block);
+                throw;
+            }
+        }
+        return std::shared_ptr<T>(data, [this, block, count] (T* ptr) {
+            destroy(ptr, count);
+            release(block);
+        });
+    }
+
+    // Back buffers of size at least hugePageSize with huge pages.
+    // Affects only buffers allocated after the call.
+    void setHugePages(bool enable) {
+        std::lock_guard<std::mutex> lock(mutex);
+        hugePages = enable;
+    }
+
+    // Limit total size of cached buffers, e.g. to working set of a job.
+    // Buffers over the limit are freed.
+    void setMaxCachedBytes(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxCachedBytes = bytes;
+        for (auto it = freeBlocks.begin(); it != freeBlocks.end() && cachedBytes_ > maxCachedBytes; ++it) {
+            while (!it->second.empty() && cachedBytes_ > maxCachedBytes) {
+                cachedBytes_ -= it->second.back().size;
+                freeBlock(it->second.back());
+                it->second.pop_back();
+            }
+        }
+    }
+
+    // Give all cached buffers back to the system, e.g. after a batch.
+    void trim() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& sizeClass : freeBlocks) {
+            for (const auto& block : sizeClass.second)
+                freeBlock(block);
+        }
+        freeBlocks.clear();
+        cachedBytes_ = 0;
+    }
+
+    // Total size of buffers, which are kept for reuse.
+    size_t cachedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cachedBytes_;
+    }
+
+private:
+    struct Block {
+        void* ptr;
+        size_t size;
+        bool mapped;
+    };
+
+    // Free blocks by size class.
+    std::map<size_t, std::vector<Block>> freeBlocks;
+    mutable std::mutex mutex;
+    size_t cachedBytes_;
+    size_t maxCachedBytes;
+    bool hugePages;
+
+    static size_t sizeClass(size_t bytes) {
+        size_t octave = minPooledBytes;
+        while (octave * 2 <= bytes)
+            octave *= 2;
+        const size_t step = octave / 4;
+        return (bytes + step - 1) / step * step;
+    }
+
+    template <typename T>
+    static void destroy(T* data, size_t count) {
+        if (!std::is_trivially_destructible<T>::value) {
+            for (size_t i = 0; i < count; ++i)
+                data[i].~T();
+        }
+    }
+
+    Block acquire(size_t bytes) {
+        if (bytes < minPooledBytes)
+            return {::operator new(bytes), bytes, false};
+
+        size_t size = sizeClass(bytes);
+        bool huge = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = freeBlocks.find(size);
+            if (it != freeBlocks.end() && !it->second.empty()) {
+                Block block = it->second.back();
+                it->second.pop_back();
+                cachedBytes_ -= block.size;
+                return block;
+            }
+            huge = hugePages && size >= hugePageSize;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (huge) {
+            void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr != MAP_FAILED) {
+                madvise(ptr, size, MADV_HUGEPAGE);
+                return {ptr, size, true};
+            }
+        }
+#else
+        (void)huge;
+#endif
+        return {::operator new(size), size, false};
+    }
+
+    void release(const Block& block) {
+        if (block.size >= minPooledBytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cachedBytes_ + block.size <= maxCachedBytes) {
+                freeBlocks[block.size].push_back(block);
+                cachedBytes_ += block.size;
+                return;
+            }
+        }
+        freeBlock(block);
+    }
+
+    static void freeBlock(const Block& block) {
+        if (block.mapped)
+            munmap(block.ptr, block.size);
+        else
+            ::operator delete(block.ptr);
+    }
+};
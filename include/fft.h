@@ -0,0 +1,26 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+// Discrete Fourier transform without external dependencies.
+//
+// Lengths which are powers of two use iterative radix-2 transform, other
+// lengths are reduced to it by Bluestein algorithm, so every length costs
+// O(n log n). Inverse transform is normalized (divided by n), so
+// fft(data); fft(data, true); gives data back.
+//
+// std::vector<std::complex<double>> data(rows * cols);
+// fft2d(data, rows, cols);
+
+// Transform of n elements of data in place.
+void fft(std::complex<double>* data, size_t n, bool inverse = false);
+
+inline void fft(std::vector<std::complex<double>>& data, bool inverse = false) {
+    fft(data.data(), data.size(), inverse);
+}
+
+// Transform of rows x cols array stored by rows. Rows and columns are
+// transformed in parallel.
+void fft2d(std::vector<std::complex<double>>& data, size_t rows, size_t cols, bool inverse = false);
@@ -2,6 +2,7 @@
 
 #include "matrix.h"
 #include "io.h"
+#include "planar_image.h"
 
 #include <cstddef>
 #include <cmath>
@@ -10,29 +11,37 @@
 #include <memory>
 #include <vector>
 
+// Rounded absolute value clamped to maxValue (PixelTraits::maxValue of samples).
 template <typename T>
-inline size_t normalizeRes(const T& val) {
-    int res = round(val);
-    if (res < 0)
-        res = -res;
-    if (res > 255)
-        res = 255;
-    return res;
+inline size_t normalizeRes(const T& val, uint maxValue) {
+    double res = std::abs(std::round(static_cast<double>(val)));
+    if (res > maxValue)
+        return maxValue;
+    return static_cast<size_t>(res);
 }
 
 template <typename T>
-std::tuple<uint, uint, uint> applyKernel(const Image &image, const Matrix<T>& kernel) {
+inline size_t normalizeRes(const T& val) {
+    return normalizeRes(val, 255);
+}
+
+template <typename PixelT, typename T>
+PixelT applyKernel(const Matrix<PixelT> &image, const Matrix<T>& kernel) {
+    typedef PixelTraits<PixelT> Traits;
     if (image.n_rows != kernel.n_rows || image.n_cols != kernel.n_cols)
         throw std::logic_error("can't apply gauss kernel, don't correct size subimage");
-    T resR = 0, resG = 0, resB = 0;
+    T res[Traits::channels];
+    std::fill(std::begin(res), std::end(res), 0);
     for (size_t row = 0; row < kernel.n_rows; ++row) {
         for (size_t col = 0; col < kernel.n_cols; ++col) {
-            resR += std::get<0>(image(row, col)) * kernel(row, col);
-            resG += std::get<1>(image(row, col)) * kernel(row, col);
-            resB += std::get<2>(image(row, col)) * kernel(row, col);
+            for (size_t ch = 0; ch < Traits::channels; ++ch)
+                res[ch] += Traits::get(image(row, col), ch) * kernel(row, col);
         }
     }
-    return std::make_tuple(normalizeRes(resR), normalizeRes(resG), normalizeRes(resB));
+    PixelT pixel;
+    for (size_t ch = 0; ch < Traits::channels; ++ch)
+        Traits::set(pixel, ch, normalizeRes(res[ch], Traits::maxValue));
+    return pixel;
 }
 
 class BaseFilterImpl {
@@ -53,6 +62,12 @@ public:
         return applyKernel(image, kernel);
     }
 
+    // Same kernel applied to neighbourhood of a single plane.
+    template <typename PixelT>
+    PixelT operator () (const Matrix<PixelT>& image) const {
+        return applyKernel(image, kernel);
+    }
+
 private:
     Matrix<T> kernel;
 
@@ -60,6 +75,57 @@ public:
     size_t n_rows, n_cols;
 };
 
+// Kernel of size (2 * R + 1) x (2 * R + 1) known at compile time.
+// Unlike KernelFilterImpl loops over taps have constant bounds and are
+// fully unrolled, and coefficients of constexpr kernels are folded into
+// the code. Gives the same results as KernelFilterImpl with equal kernel.
+//
+// constexpr FixedKernel<int, 1> box = {{{1, 1, 1}, {1, 1, 1}, {1, 1, 1}}};
+// Image blurred = image.unary_map(box);
+template <typename T, size_t R>
+struct FixedKernel {
+    static const size_t n_rows = 2 * R + 1, n_cols = 2 * R + 1;
+
+    T coeffs[n_rows][n_cols];
+
+    template <typename PixelT>
+    PixelT operator () (const Matrix<PixelT>& image) const {
+        typedef PixelTraits<PixelT> Traits;
+        T res[Traits::channels] = {};
+        for (size_t row = 0; row < n_rows; ++row) {
+            const PixelT* src = image.row_ptr(row);
+            for (size_t col = 0; col < n_cols; ++col) {
+                for (size_t ch = 0; ch < Traits::channels; ++ch)
+                    res[ch] += Traits::get(src[col], ch) * coeffs[row][col];
+            }
+        }
+        PixelT pixel;
+        for (size_t ch = 0; ch < Traits::channels; ++ch)
+            Traits::set(pixel, ch, normalizeRes(res[ch], Traits::maxValue));
+        return pixel;
+    }
+
+    // Kernel with coefficients known only at runtime (like gauss kernel
+    // for given sigma).
+    static FixedKernel fromMatrix(const Matrix<T>& kernel) {
+        if (kernel.n_rows != n_rows || kernel.n_cols != n_cols)
+            throw std::logic_error("size of kernel doesn't match fixed kernel");
+        FixedKernel res;
+        for (size_t row = 0; row < n_rows; ++row)
+            std::copy(kernel.row_ptr(row), kernel.row_ptr(row) + n_cols, res.coeffs[row]);
+        return res;
+    }
+};
+
+template <typename T, size_t R>
+const size_t FixedKernel<T, R>::n_rows;
+
+template <typename T, size_t R>
+const size_t FixedKernel<T, R>::n_cols;
+
+constexpr FixedKernel<int, 1> sobelKernelX = {{{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}}};
+constexpr FixedKernel<int, 1> sobelKernelY = {{{1, 2, 1}, {0, 0, 0}, {-1, -2, -1}}};
+
 class BaseFilterWrapper {
 public:
     virtual Image applyToImage(const Image& image) const = 0;
@@ -86,16 +152,32 @@ static Matrix<double> getGaussKernel(size_t radius, double sigma) {
     return kernel;
 }
 
+// Kernel filters below take border mode of unary_map. With default
+// BorderMode::NONE pixels closer than radius to the border are left zero.
 class GaussFilter : public BaseFilterWrapper {
 public:
-    GaussFilter(size_t radius, double sigma) : impl(getGaussKernel(radius, sigma)) {}
+    GaussFilter(size_t radius, double sigma, BorderMode border_ = BorderMode::NONE)
+        : impl(getGaussKernel(radius, sigma)), fixedImpl(), useFixed(radius == 2), border(border_)
+    {
+        // 5x5 kernel is used by canny, so it has specialized version.
+        if (useFixed)
+            fixedImpl = FixedKernel<double, 2>::fromMatrix(getGaussKernel(radius, sigma));
+    }
 
     Image applyToImage(const Image& image) const override {
-        return image.unary_map(impl);
+        return apply(image);
+    }
+
+    template <typename PixelT>
+    Matrix<PixelT> apply(const Matrix<PixelT>& image) const {
+        return useFixed ? image.unary_map(fixedImpl, border) : image.unary_map(impl, border);
     }
 
 private:
     KernelFilterImpl<double> impl;
+    FixedKernel<double, 2> fixedImpl;
+    bool useFixed;
+    BorderMode border;
 };
 
 template <typename T>
@@ -120,40 +202,71 @@ static std::pair<Matrix<double>, Matrix<double>> getSepGaussKernel(size_t radius
     return {gorizontal, vertical};
 }
 
+// Separable filter: rowOp (1 x n operator) is applied to rows of image,
+// then colOp (also 1 x n operator) is applied to columns. Columns are
+// filtered as rows of transposed image, so both passes walk memory along
+// rows instead of jumping over whole row for every tap. Result is the same
+// as filtering by rowOp and by transposed colOp with unary_map.
+template <typename PixelT, typename RowOp, typename ColOp>
+Matrix<PixelT> applySeparable(const Matrix<PixelT>& image, const RowOp& rowOp, const ColOp& colOp,
+                              BorderMode border = BorderMode::NONE) {
+    if (rowOp.n_rows != 1 || colOp.n_rows != 1)
+        throw std::logic_error("separable filter takes 1 x n operators");
+    return image.unary_map(rowOp, border).transpose().unary_map(colOp, border).transpose();
+}
+
 class GaussSepFilter : public BaseFilterWrapper {
 public:
-    GaussSepFilter(size_t radius, double sigma) : filters(getSepGaussKernel(radius, sigma)) {}
+    GaussSepFilter(size_t radius, double sigma, BorderMode border_ = BorderMode::NONE)
+        : impl(getSepGaussKernel(radius, sigma).first), border(border_) {}
 
     Image applyToImage(const Image& image) const override {
-        return image.unary_map(filters.first).unary_map(filters.second);
+        return apply(image);
+    }
+
+    template <typename PixelT>
+    Matrix<PixelT> apply(const Matrix<PixelT>& image) const {
+        // vertical kernel is the transposed horizontal one.
+        return applySeparable(image, impl, impl, border);
     }
 
 private:
-    std::pair<KernelFilterImpl<double>, KernelFilterImpl<double>> filters;
+    KernelFilterImpl<double> impl;
+    BorderMode border;
 };
 
 class SobelKernelX : public BaseFilterWrapper {
 public:
-    SobelKernelX() : impl({{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}}) {}
+    SobelKernelX(BorderMode border_ = BorderMode::NONE) : border(border_) {}
 
     Image applyToImage(const Image& image) const override {
-        return image.unary_map(impl);
+        return apply(image);
+    }
+
+    template <typename PixelT>
+    Matrix<PixelT> apply(const Matrix<PixelT>& image) const {
+        return image.unary_map(sobelKernelX, border);
     }
 
 private:
-    KernelFilterImpl<int> impl;
+    BorderMode border;
 };
 
 class SobelKernelY : public BaseFilterWrapper {
 public:
-    SobelKernelY() : impl({{1, 2, 1}, {0, 0, 0}, {-1, -2, -1}}) {}
+    SobelKernelY(BorderMode border_ = BorderMode::NONE) : border(border_) {}
 
     Image applyToImage(const Image& image) const override {
-        return image.unary_map(impl);
+        return apply(image);
+    }
+
+    template <typename PixelT>
+    Matrix<PixelT> apply(const Matrix<PixelT>& image) const {
+        return image.unary_map(sobelKernelY, border);
     }
 
 private:
-    KernelFilterImpl<int> impl;
+    BorderMode border;
 };
 
 class Histogram {
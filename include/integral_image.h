@@ -0,0 +1,88 @@
+#pragma once
+
+#include "matrix.h"
+#include "planar_image.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// What integral image sums: values of pixels or their squares.
+enum class IntegralValue {
+    VALUE, SQUARE
+};
+
+// Summed-area table of an image: after O(rows * cols) construction sum
+// of values in any rectangle costs O(1). Only first channel of pixels
+// is summed (see channelValue). Sums are 64-bit, so they don't overflow
+// on big plates even for squares of 16-bit samples.
+//
+// IntegralImage squares(plane, IntegralValue::SQUARE);
+// unsigned long long energy = squares.sum(10, 10, 100, 200);
+class IntegralImage {
+public:
+    IntegralImage() : table(1, 1) {}
+
+    template <typename PixelT>
+    explicit IntegralImage(const Matrix<PixelT>& image, IntegralValue value = IntegralValue::VALUE)
+        : table(image.n_rows + 1, image.n_cols + 1)
+    {
+        const uint rows = image.n_rows, cols = image.n_cols;
+        if (rows * cols == 0)
+            return;
+        auto& pool = ThreadPool::global();
+        const size_t minBand = std::max<size_t>((1 << 16) / cols, 1);
+
+        // prefix sums of rows, table(i + 1, j + 1) = sum of row i up to column j.
+        pool.parallelFor(0, rows, minBand, [&] (size_t begin, size_t end) {
+            for (size_t row = begin; row < end; ++row) {
+                const PixelT* src = image.row_ptr(row);
+                uint64_t* dst = table.row_ptr(row + 1) + 1;
+                uint64_t sum = 0;
+                for (uint col = 0; col < cols; ++col) {
+                    uint64_t val = channelValue(src[col]);
+                    sum += value == IntegralValue::SQUARE ? val * val : val;
+                    dst[col] = sum;
+                }
+            }
+        });
+
+        // accumulate rows from top to bottom, strips of columns are independent.
+        const size_t minStrip = std::max<size_t>((1 << 16) / rows, 64);
+        pool.parallelFor(1, cols + 1, minStrip, [&] (size_t begin, size_t end) {
+            for (uint row = 1; row < rows; ++row) {
+                const uint64_t* prev = table.row_ptr(row);
+                uint64_t* cur = table.row_ptr(row + 1);
+                for (size_t col = begin; col < end; ++col)
+                    cur[col] += prev[col];
+            }
+        });
+    }
+
+    uint n_rows() const {
+        return table.n_rows - 1;
+    }
+
+    uint n_cols() const {
+        return table.n_cols - 1;
+    }
+
+    // Sum over rectangle of size rows x cols with top left corner (row, col).
+    unsigned long long sum(uint row, uint col, uint rows, uint cols) const {
+        if (row + rows > n_rows() || col + cols > n_cols())
+            throw std::string("Out of bounds");
+        const uint64_t* top = table.row_ptr(row);
+        const uint64_t* bottom = table.row_ptr(row + rows);
+        return bottom[col + cols] - bottom[col] - top[col + cols] + top[col];
+    }
+
+    // Sum over whole image.
+    unsigned long long total() const {
+        return sum(0, 0, n_rows(), n_cols());
+    }
+
+private:
+    // (n_rows + 1) x (n_cols + 1), first row and column are zero.
+    Matrix<uint64_t> table;
+};
@@ -1,11 +1,119 @@
 #pragma once
 
 #include "matrix.h"
+#include "planar_image.h"
 #include "EasyBMP.h"
 
+#include <memory>
 #include <tuple>
 
 typedef Matrix<std::tuple<uint, uint, uint>> Image;
 
 Image load_image(const char*);
+// Images are written as uncompressed 24-bit BMP, rows are formatted
+// in parallel straight into file buffer.
 void save_image(const Image&, const char*);
+
+// Same as load_image, but decodes file straight into three 8-bit planes.
+PlanarImage8 load_planar_image(const char*);
+
+// One channel of image (0 - red, 1 - green, 2 - blue) as a plane.
+// Uncompressed 8, 24 and 32-bit files are decoded natively from mapped
+// file, other are read by EasyBMP. For top-down 8-bit grayscale file
+// plane points right into mapped pixel rows, nothing is copied.
+Plane8 load_plane(const char*, size_t channel = 0);
+
+// Rectangle of image: rows [row, row + rows), columns [col, col + cols).
+// Only rows of rectangle are read from uncompressed file and decoded.
+Image load_image_roi(const char*, uint row, uint col, uint rows, uint cols);
+Plane8 load_plane_roi(const char*, uint row, uint col, uint rows, uint cols, size_t channel = 0);
+void save_image(const PlanarImage8&, const char*);
+
+// Plane as 8-bit grayscale BMP, a third of size of 24-bit file.
+void save_plane(const Plane8&, const char*);
+
+// Baseline TIFF files with 8 or 16-bit gray or RGB samples, uncompressed
+// or PackBits. Samples are decoded straight into 16-bit planes, values of
+// 8-bit files are not scaled. Gray file gives three equal planes.
+bool is_tiff_path(const char*);
+PlanarImage16 load_tiff(const char*);
+Plane16 load_tiff_plane(const char*, size_t channel = 0);
+// Written files are little-endian, 16 bits per sample.
+void save_tiff(const PlanarImage16&, const char*, bool packBits = false);
+void save_tiff(const Plane16&, const char*, bool packBits = false);
+
+enum class ImageFormat {
+    BMP, TIFF
+};
+
+// What is known about image from its header.
+struct ImageInfo {
+    ImageFormat format;
+    uint n_rows, n_cols;
+    // 8 or 16.
+    uint bitsPerSample;
+    // 1 for grayscale images, 3 otherwise.
+    uint channels;
+    // True if rectangles of file (load_image_roi, load_plane_roi) are read
+    // without decoding whole image, false if file is decoded by EasyBMP.
+    bool partialReads;
+
+    // Memory taken by one decoded plane (load_plane, load_tiff_plane).
+    size_t planeBytes() const {
+        return static_cast<size_t>(n_rows) * n_cols * (bitsPerSample / 8);
+    }
+
+    // Memory taken by whole decoded planar image.
+    size_t decodedBytes() const {
+        return planeBytes() * channels;
+    }
+};
+
+// Reads only header of BMP or TIFF file (format is found by signature),
+// so jobs can be planned before pixels are decoded.
+ImageInfo probe_image(const char*);
+
+// Reads uncompressed BMP file by bands of rows, so plates bigger than
+// memory can be processed. Only header is read on construction.
+//
+// BmpReader reader(path);
+// Plane8 band = reader.read_rows(row, 256);
+class BmpReader {
+public:
+    explicit BmpReader(const char*);
+    ~BmpReader();
+
+    BmpReader(const BmpReader&) = delete;
+    BmpReader& operator = (const BmpReader&) = delete;
+
+    uint n_rows() const;
+    uint n_cols() const;
+
+    // Rows [row, row + count) of one channel (0 - red, 1 - green, 2 - blue).
+    Plane8 read_rows(uint row, uint count, size_t channel = 0) const;
+
+    // Parsed header, defined in io.cpp.
+    struct Header;
+
+private:
+    int fd;
+    std::unique_ptr<Header> header;
+};
+
+// Writes 24-bit BMP file of known size by bands of rows, bands may come
+// in any order. File is the same as save_image writes.
+class BmpWriter {
+public:
+    BmpWriter(const char*, uint row_count, uint col_count);
+    ~BmpWriter();
+
+    BmpWriter(const BmpWriter&) = delete;
+    BmpWriter& operator = (const BmpWriter&) = delete;
+
+    // Write band as rows [row, row + band.n_rows()) of image.
+    void write_rows(uint row, const PlanarImage8& band);
+
+private:
+    int fd;
+    uint rows, cols;
+};
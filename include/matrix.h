@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <initializer_list>
 #include <algorithm>
 #include <tuple>
@@ -7,21 +8,88 @@
 #include <iostream>
 #include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "thread_pool.h"
 
 typedef unsigned int uint;
 
+// Checks if operator has merge hook: void merge(const Op&).
+template<typename Op, typename = void>
+struct has_merge_hook : std::false_type {};
+
+template<typename Op>
+struct has_merge_hook<Op, decltype(std::declval<Op&>().merge(std::declval<const Op&>()), void())>
+    : std::true_type {};
+
+// How unary_map computes pixels, which neighbourhood doesn't fit in matrix.
+// Examples show row "abcd" extended by 3 elements on both sides.
+enum class BorderMode {
+    NONE,       // such pixels are not computed and stay value-initialized
+    REFLECT,    // edge elements are repeated: cba|abcd|dcb (same as mirror())
+    REPLICATE,  // edge element is repeated: aaa|abcd|ddd
+    CONSTANT,   // given value is used outside: vvv|abcd|vvv
+    WRAP        // matrix is tiled: bcd|abcd|abc
+};
+
+// Copy-on-write mode of all matrices, off by default, the align tool
+// switches it on at start.
+//
+// Copies of matrix share data anyway, but normally writes through one
+// copy are seen by all of them, so callers make deep copies to own data.
+// In copy-on-write mode Matrix::copy() is as cheap as shallow copy, and
+// non-const operator() and row_ptr() of matrix, which shares data with
+// other matrices, first make a private copy of it (detach). The check is
+// two relaxed loads, hot loops still take row_ptr() once per row. Write
+// through data pointer taken before matrix was copied is not detected,
+// and first write to shared matrix must not race with other threads
+// using that matrix (call row_ptr() before sharing work on it).
+//
+// copy() of submatrix is a view, which keeps the whole parent buffer alive,
+// use materialize() or deep_copy() where independent buffer is needed.
+//
+// The flag lives in the module, which calls set_copy_on_write: plugins
+// loaded by dlopen have their own flag (executable isn't linked with
+// -rdynamic), which stays off, so copy() is always deep in plugins.
+inline std::atomic<bool> &matrix_copy_on_write_flag()
+{
+    static std::atomic<bool> flag(false);
+    return flag;
+}
+
+inline void set_copy_on_write(bool enable)
+{
+    matrix_copy_on_write_flag().store(enable, std::memory_order_relaxed);
+}
+
+inline bool copy_on_write()
+{
+    return matrix_copy_on_write_flag().load(std::memory_order_relaxed);
+}
+
 template<typename ValueT>
 class Matrix
 {
 public:
+    // Type of elements
+    typedef ValueT value_type;
+
     // Number of rows
     const uint n_rows;
     // Number of cols
     const uint n_cols;
 
-    // Construct matrix with row_count of rows and col_count of columns
+    // Construct matrix with row_count of rows and col_count of columns.
+    // Elements are value-initialized, memory is taken from
+    // BufferPool::global(), so big matrices reuse freed buffers.
     Matrix(uint row_count=0, uint col_count=0);
 
+    // Same, but elements of trivial type are not zeroed (like new T[n]).
+    // For results, every element of which is written anyway.
+    static Matrix<ValueT> uninitialized(uint row_count, uint col_count);
+
     // Construct and initialize matrix which consists of one row.
     //
     // Example:
@@ -35,11 +103,24 @@ public:
     //                            {0.5, 0.6, 0.7, 0.8} };
     Matrix(std::initializer_list<std::initializer_list<ValueT>>);
 
+    // Matrix over external memory (like mapped file): rows start
+    // row_stride elements apart from data. Memory is not copied, data
+    // must keep it alive (use aliasing constructor of shared_ptr to
+    // point into memory owned by other object).
+    Matrix(uint row_count, uint col_count, uint row_stride, std::shared_ptr<ValueT> data);
+
     // Shallow copy. Be careful, this function just copies the pointer
     // to data and doesn't allocate any memory for data!
     Matrix(const Matrix&);
     // Deep copy. Allocates memory and copies all values
     Matrix<ValueT> deep_copy() const;
+    // Copy, which owns its values: deep copy, or shallow one
+    // in copy-on-write mode (see set_copy_on_write).
+    Matrix<ValueT> copy() const;
+    // Matrix with the same values, which doesn't hold memory outside of it
+    // (unlike submatrix). It is this matrix (shallow copy) if it already
+    // covers its whole buffer, deep copy otherwise.
+    Matrix<ValueT> materialize() const;
 
     // Assignment operator
     const Matrix<ValueT> &operator = (const Matrix<ValueT> &);
@@ -63,6 +144,29 @@ public:
     // cout << a; // 9 3 7
     ValueT &operator() (uint row, uint col);
 
+    // Raw row access for hot loops.
+    //
+    // Returns pointer to the first element of row, elements of the row
+    // follow each other in memory: row_ptr(i)[j] is the same as (*this)(i, j).
+    // No bounds checking is done unless MATRIX_CHECKED is defined
+    // (see Makefile), so inner loops compile to plain pointer arithmetic.
+    //
+    // for (uint i = 0; i < a.n_rows; ++i) {
+    //     int *row = a.row_ptr(i);
+    //     for (uint j = 0; j < a.n_cols; ++j)
+    //         row[j] = 0;
+    // }
+    ValueT *row_ptr(uint row);
+    const ValueT *row_ptr(uint row) const;
+    // Same as const row_ptr, but can be called on non-const matrix.
+    const ValueT *const_row(uint row) const;
+
+    // Number of elements between beginnings of two neighbouring rows.
+    uint row_stride() const;
+    // True if rows follow each other without gaps, so whole matrix
+    // can be walked as one array of n_rows * n_cols elements from row_ptr(0).
+    bool is_contiguous() const;
+
     // Matrix convolution.
     //
     // You give this function a unary operator. Operator _must_
@@ -73,6 +177,15 @@ public:
     // (2 * radius + 1) x (2 * radius + 1), applies operator to that
     // neighbourhood and writes result in a new matrix of the same size
     // Minimum radius is 0, operator will process only one pixel every time
+    //
+    // Neighbourhood passed to operator is a non-owning window into this
+    // matrix, which is moved from pixel to pixel: nothing is allocated and
+    // no reference counters are touched per pixel. So operator must not keep
+    // neighbourhood (or its copies) after it returns.
+    //
+    // With ExecutionPolicy::PARALLEL (default) rows of the result are split
+    // into bands, processed by ThreadPool::global(). Operator is shared
+    // between threads, so its operator() must be safe to call concurrently.
     template<typename UnaryMatrixOperator>
     // Function unary map returns a matrix of
     Matrix<
@@ -82,27 +195,51 @@ public:
             UnaryMatrixOperator(Matrix<ValueT>)
         >::type
     >
-    unary_map(const UnaryMatrixOperator &op) const;
+    unary_map(const UnaryMatrixOperator &op,
+              ExecutionPolicy policy = ExecutionPolicy::PARALLEL) const;
 
     // Same, but unary operator is mutable.
     // If you take operator with mutable fields, you can
     // make statistic computations using unary map
     // (statistics like sum of pixel values or histograms of pixel values)
+    //
+    // Mutable operator is run in parallel only if it has merge hook
+    // void merge(const UnaryMatrixOperator &clone). Then first band is
+    // processed by op itself and every other band by its own clone (copy of
+    // op made before the map starts). When all bands are done, op.merge(clone)
+    // is called for every clone in order of bands. Clones start with state of
+    // op, so statistics should be empty before the map to be counted once.
+    // Operators without merge hook are always run sequentially.
     template<typename UnaryMatrixOperator>
     Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
-    unary_map(UnaryMatrixOperator &op) const;
+    unary_map(UnaryMatrixOperator &op,
+              ExecutionPolicy policy = ExecutionPolicy::PARALLEL) const;
 
-    // binary_map has the same idea as unary_map,
-    // but now operator takes two neighbourhoods. For example,
-    // if radius = 0, you can make operator, which make elementwise
-    // product of two matrices.
+    // Both unary_map's with border mode: border pixels are computed too,
+    // elements of their neighbourhood outside the matrix are taken as
+    // border says (border_value is used only by BorderMode::CONSTANT).
+    //
+    // Interior pixels still get windows into this matrix, border ones get
+    // a small buffer, filled for every such pixel.
     //
-    // This function isn't implemented, if you understood unary_map, using its
-    // code you can easily implement binary_map.
-    template<typename BinaryMatrixOperator>
-    friend Matrix<ValueT> binary_map(const BinaryMatrixOperator&,
-                                     const Matrix<ValueT>&,
-                                     const Matrix<ValueT>&);
+    // Image blurred = image.unary_map(GaussOp(), BorderMode::REFLECT);
+    template<typename UnaryMatrixOperator>
+    Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+    unary_map(const UnaryMatrixOperator &op, BorderMode border,
+              const ValueT &border_value = ValueT(),
+              ExecutionPolicy policy = ExecutionPolicy::PARALLEL) const;
+    template<typename UnaryMatrixOperator>
+    Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+    unary_map(UnaryMatrixOperator &op, BorderMode border,
+              const ValueT &border_value = ValueT(),
+              ExecutionPolicy policy = ExecutionPolicy::PARALLEL) const;
+
+    // binary_map and nary_map are declared below the class.
+
+    // Transposed copy of matrix. Copied in square blocks, which fit in
+    // cache both for reading rows and writing columns, blocks are
+    // processed in parallel.
+    Matrix<ValueT> transpose() const;
 
     // Get sumbmatrix of matrix
     // Remember that indexing starts at 0!
@@ -117,22 +254,140 @@ public:
                                    uint rows, uint cols) const;
 
 private:
+    // Gives window API to free map functions.
+    friend struct MatrixWindows;
+
+    // Return type of unary_map for operator type (possibly const).
+    template<typename UnaryMatrixOperator>
+    using unary_map_result = Matrix<typename std::result_of<
+        typename std::remove_const<UnaryMatrixOperator>::type(Matrix<ValueT>)>::type>;
+
+    // Common implementation of all unary_map's. Operators are given
+    // for every band of rows: bandOps[i] processes i-th band.
+    template<typename UnaryMatrixOperator>
+    unary_map_result<UnaryMatrixOperator>
+    unary_map_impl(const std::vector<UnaryMatrixOperator*> &bandOps,
+                   BorderMode border, const ValueT &border_value) const;
+
+    // Mutable unary_map for operators with and without merge hook.
+    template<typename UnaryMatrixOperator>
+    unary_map_result<UnaryMatrixOperator>
+    unary_map_mutable(UnaryMatrixOperator &op, ExecutionPolicy policy,
+                      BorderMode border, const ValueT &border_value, std::true_type) const;
+    template<typename UnaryMatrixOperator>
+    unary_map_result<UnaryMatrixOperator>
+    unary_map_mutable(UnaryMatrixOperator &op, ExecutionPolicy policy,
+                      BorderMode border, const ValueT &border_value, std::false_type) const;
+
+    // Number of bands unary_map splits rows on.
+    template<typename UnaryMatrixOperator>
+    uint unary_map_bands(const UnaryMatrixOperator &op, ExecutionPolicy policy,
+                         BorderMode border) const;
+
+    // Fill neighbourhood of size dst.n_rows x dst.n_cols, which starts at
+    // (row, col) of this matrix (possibly outside), using border mode.
+    void fill_border_neighbourhood(Matrix<ValueT> &dst, int row, int col,
+                                   BorderMode border, const ValueT &border_value) const;
+
+    // Non-owning window of size rows x cols, which starts at (0, 0) of this
+    // matrix. Window doesn't hold the data, so it must not outlive matrix.
+    Matrix<ValueT> window(uint rows, uint cols) const;
+    // Move window, so it starts at (row, col) of matrix it was taken from.
+    // No bounds checking is done.
+    void move_window(uint row, uint col);
+
     // Stride - number of elements between two rows (needed for efficient
     // submatrix function without memory copy)
     const uint stride;
     // First row and col, useful for taking submatrices. By default is (0, 0).
     const uint pin_row, pin_col;
+    // Number of rows in buffer (n_rows of matrix which allocated it).
+    const uint buffer_rows;
     // shared_ptr still has no support of c-style arrays and
     // <type[]> partial specialization like unique_ptr has.
     // works: unique_ptr<int[]>; doesn't: shared_ptr<int[]>.
     // so, for now we use shared_ptr just for counting links,
-    // and work with raw pointer through get().
+    // and work with raw pointer through get(). Deleter gives
+    // memory back to BufferPool.
     std::shared_ptr<ValueT> _data;
 
+    // Make private copy of shared data in copy-on-write mode.
+    void detach();
+
     // Const cast for writing public const fields.
     template<typename T> inline T& make_rw(const T& val) const;
 };
 
+// Access to non-owning windows of matrices for free map functions.
+struct MatrixWindows {
+    template<typename ValueT>
+    static Matrix<ValueT> window(const Matrix<ValueT> &m, uint rows, uint cols)
+    {
+        return m.window(rows, cols);
+    }
+
+    template<typename ValueT>
+    static void move_window(Matrix<ValueT> &window, uint row, uint col)
+    {
+        window.move_window(row, col);
+    }
+};
+
+// Checks if operator is a stencil operator: has n_rows and n_cols
+// of neighbourhood. Otherwise operator is elementwise and takes values.
+template<typename Op, typename = void>
+struct is_stencil_operator : std::false_type {};
+
+template<typename Op>
+struct is_stencil_operator<Op, decltype(void(std::declval<const Op&>().n_rows))>
+    : std::true_type {};
+
+template<bool Stencil, typename Op, typename... ValueTs>
+struct nary_map_value;
+
+template<typename Op, typename... ValueTs>
+struct nary_map_value<true, Op, ValueTs...> {
+    typedef typename std::result_of<Op(Matrix<ValueTs>...)>::type type;
+};
+
+template<typename Op, typename... ValueTs>
+struct nary_map_value<false, Op, ValueTs...> {
+    typedef typename std::result_of<Op(const ValueTs&...)>::type type;
+};
+
+// Return type of nary_map and binary_map.
+template<typename Op, typename... ValueTs>
+using nary_map_result = Matrix<typename std::decay<
+    typename nary_map_value<is_stencil_operator<Op>::value, Op, ValueTs...>::type>::type>;
+
+// nary_map has the same idea as unary_map, but operator takes
+// neighbourhoods of the same pixel in several matrices of equal size.
+//
+// Stencil operator has n_rows, n_cols fields and
+// operator()(const Matrix<ValueT1>&, const Matrix<ValueT2>&, ...),
+// it is called like in unary_map, border pixels are left unset.
+//
+// Elementwise operator (no n_rows, n_cols) takes values of pixels:
+// operator()(const ValueT1&, const ValueT2&, ...). Such operators are
+// applied to whole rows in a plain loop, which compiler can vectorize,
+// no windows are built at all.
+//
+// Rows are processed in parallel by ThreadPool::global(), so operator
+// must be safe to call concurrently.
+//
+// Matrix<double> length = nary_map([] (int dx, int dy) {
+//     return sqrt(dx * dx + dy * dy);
+// }, derivativeX, derivativeY);
+template<typename NaryOperator, typename... ValueTs>
+nary_map_result<NaryOperator, ValueTs...>
+nary_map(const NaryOperator &op, const Matrix<ValueTs>&... matrices);
+
+// binary_map is nary_map for two matrices. For example, with
+// elementwise operator you can make elementwise product of two matrices.
+template<typename BinaryMatrixOperator, typename ValueT1, typename ValueT2>
+nary_map_result<BinaryMatrixOperator, ValueT1, ValueT2>
+binary_map(const BinaryMatrixOperator &op, const Matrix<ValueT1> &m1, const Matrix<ValueT2> &m2);
+
 // Output for matrix. Useful for debugging
 template<typename ValueT>
 std::ostream &operator << (std::ostream &out, const Matrix<ValueT> &m)
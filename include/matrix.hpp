@@ -13,11 +13,40 @@ Matrix<ValueT>::Matrix(uint row_count, uint col_count):
     stride{n_cols},
     pin_row{0},
     pin_col{0},
+    buffer_rows{n_rows},
     _data{}
 {
     auto size = n_cols * n_rows;
+    // Value-initialize elements, so scalar matrices start zeroed as tuple ones do.
     if (size)
-        _data.reset(new ValueT[size], std::default_delete<ValueT[]>());
+        _data = BufferPool::global().allocate<ValueT>(size);
+}
+
+template<typename ValueT>
+Matrix<ValueT> Matrix<ValueT>::uninitialized(uint row_count, uint col_count)
+{
+    Matrix<ValueT> tmp;
+    tmp.make_rw(tmp.n_rows) = row_count;
+    tmp.make_rw(tmp.n_cols) = col_count;
+    tmp.make_rw(tmp.stride) = col_count;
+    tmp.make_rw(tmp.buffer_rows) = row_count;
+    if (row_count != 0 and col_count != 0)
+        tmp._data = BufferPool::global().allocate<ValueT>(row_count * col_count, false);
+    return tmp;
+}
+
+template<typename ValueT>
+Matrix<ValueT>::Matrix(uint row_count, uint col_count, uint row_stride, std::shared_ptr<ValueT> data):
+    n_rows{row_count},
+    n_cols{col_count},
+    stride{row_stride},
+    pin_row{0},
+    pin_col{0},
+    buffer_rows{n_rows},
+    _data{std::move(data)}
+{
+    if (stride < n_cols)
+        throw std::string("row stride is less than number of columns");
 }
 
 template<typename ValueT>
@@ -27,10 +56,11 @@ Matrix<ValueT>::Matrix(std::initializer_list<ValueT> lst):
     stride{n_cols},
     pin_row{0},
     pin_col{0},
+    buffer_rows{n_rows},
     _data{}
 {
     if (n_cols) {
-        _data.reset(new ValueT[n_cols], std::default_delete<ValueT[]>());
+        _data = BufferPool::global().allocate<ValueT>(n_cols);
         std::copy(lst.begin(), lst.end(), _data.get());
     }
 }
@@ -38,13 +68,47 @@ Matrix<ValueT>::Matrix(std::initializer_list<ValueT> lst):
 template<typename ValueT>
 Matrix<ValueT> Matrix<ValueT>::deep_copy() const
 {
-    Matrix<ValueT> tmp(n_rows, n_cols);
-    for (uint i = 0; i < n_rows; ++i)
-        for (uint j = 0; j < n_cols; ++j)
-            tmp(i, j) = (*this)(i, j);
+    Matrix<ValueT> tmp = uninitialized(n_rows, n_cols);
+    if (n_rows * n_cols == 0)
+        return tmp;
+    // bands of rows are copied in bulk, big frames in parallel.
+    const uint min_band = std::max<uint>((1 << 18) / n_cols, 1);
+    const bool contiguous = is_contiguous();
+    ThreadPool::global().parallelFor(0, n_rows, min_band, [&] (size_t begin, size_t end) {
+        ValueT *dst = tmp._data.get() + begin * n_cols;
+        if (contiguous) {
+            const ValueT *src = row_ptr(begin);
+            std::copy(src, src + (end - begin) * n_cols, dst);
+            return;
+        }
+        for (size_t i = begin; i < end; ++i, dst += n_cols)
+            std::copy(row_ptr(i), row_ptr(i) + n_cols, dst);
+    });
     return tmp;
 }
 
+template<typename ValueT>
+Matrix<ValueT> Matrix<ValueT>::materialize() const
+{
+    bool whole = pin_row == 0 and pin_col == 0 and stride == n_cols and n_rows == buffer_rows;
+    return whole ? *this : deep_copy();
+}
+
+template<typename ValueT>
+Matrix<ValueT> Matrix<ValueT>::copy() const
+{
+    return copy_on_write() ? *this : deep_copy();
+}
+
+template<typename ValueT>
+inline
+void Matrix<ValueT>::detach()
+{
+    // windows have no owner, their use_count is 0.
+    if (copy_on_write() and _data.use_count() > 1)
+        *this = deep_copy();
+}
+
 template<typename ValueT>
 const Matrix<ValueT> &Matrix<ValueT>::operator = (const Matrix<ValueT> &m)
 {
@@ -53,6 +117,7 @@ const Matrix<ValueT> &Matrix<ValueT>::operator = (const Matrix<ValueT> &m)
     make_rw(stride) = m.stride;
     make_rw(pin_row) = m.pin_row;
     make_rw(pin_col) = m.pin_col;
+    make_rw(buffer_rows) = m.buffer_rows;
     _data = m._data;
     return *this;
 }
@@ -63,6 +128,7 @@ Matrix<ValueT>::Matrix(std::initializer_list<std::initializer_list<ValueT>> lsts
     stride{n_cols},
     pin_row{0},
     pin_col{0},
+    buffer_rows{n_rows},
     _data{}
 {
     // check if no action is needed.
@@ -89,7 +155,7 @@ Matrix<ValueT>::Matrix(std::initializer_list<std::initializer_list<ValueT>> lsts
         return;
 
     // allocating matrix memory.
-    _data.reset(new ValueT[n_cols * n_rows], std::default_delete<ValueT[]>());
+    _data = BufferPool::global().allocate<ValueT>(n_cols * n_rows);
 
     // copying matrix data.
     {
@@ -110,6 +176,7 @@ Matrix<ValueT>::Matrix(const Matrix &src):
     stride{src.stride},
     pin_row{src.pin_row},
     pin_col{src.pin_col},
+    buffer_rows{src.buffer_rows},
     _data{src._data}
 {
 }
@@ -121,6 +188,7 @@ Matrix<ValueT>::Matrix(Matrix &&src):
     stride{src.stride},
     pin_row{src.pin_row},
     pin_col{src.pin_col},
+    buffer_rows{src.buffer_rows},
     _data{src._data}
 {
     // resetting state of donor object.
@@ -129,6 +197,7 @@ Matrix<ValueT>::Matrix(Matrix &&src):
     make_rw(src.stride) = 0;
     make_rw(src.pin_row) = 0;
     make_rw(src.pin_col) = 0;
+    make_rw(src.buffer_rows) = 0;
     src._data.reset();
 }
 
@@ -138,6 +207,7 @@ ValueT &Matrix<ValueT>::operator()(uint row, uint col)
 {
     if (row >= n_rows or col >= n_cols)
         throw std::string("Out of bounds");
+    detach();
     row += pin_row;
     col += pin_col;
     return _data.get()[row * stride + col];
@@ -153,6 +223,45 @@ const ValueT &Matrix<ValueT>::operator()(uint row, uint col) const
     return _data.get()[row * stride + col];
 }
 
+template<typename ValueT>
+ValueT *Matrix<ValueT>::row_ptr(uint row)
+{
+#ifdef MATRIX_CHECKED
+    if (row >= n_rows)
+        throw std::string("Out of bounds");
+#endif
+    detach();
+    return _data.get() + (pin_row + row) * stride + pin_col;
+}
+
+template<typename ValueT>
+const ValueT *Matrix<ValueT>::row_ptr(uint row) const
+{
+#ifdef MATRIX_CHECKED
+    if (row >= n_rows)
+        throw std::string("Out of bounds");
+#endif
+    return _data.get() + (pin_row + row) * stride + pin_col;
+}
+
+template<typename ValueT>
+const ValueT *Matrix<ValueT>::const_row(uint row) const
+{
+    return row_ptr(row);
+}
+
+template<typename ValueT>
+uint Matrix<ValueT>::row_stride() const
+{
+    return stride;
+}
+
+template<typename ValueT>
+bool Matrix<ValueT>::is_contiguous() const
+{
+    return stride == n_cols or n_rows <= 1;
+}
+
 template<typename ValueT>
 Matrix<ValueT>::~Matrix()
 {}
@@ -172,31 +281,189 @@ const Matrix<ValueT> Matrix<ValueT>::submatrix(uint prow, uint pcol,
     return tmp;
 }
 
+template<typename ValueT>
+Matrix<ValueT> Matrix<ValueT>::transpose() const
+{
+    Matrix<ValueT> tmp = uninitialized(n_cols, n_rows);
+    if (n_rows * n_cols == 0)
+        return tmp;
+    const uint block = 32;
+    const uint row_blocks = (n_rows + block - 1) / block;
+    ValueT *dst = tmp._data.get();
+    ThreadPool::global().parallelFor(0, row_blocks, 1, [&] (size_t begin, size_t end) {
+        for (uint i0 = begin * block; i0 < std::min<size_t>(end * block, n_rows); i0 += block) {
+            const uint i1 = std::min(i0 + block, n_rows);
+            for (uint j0 = 0; j0 < n_cols; j0 += block) {
+                const uint j1 = std::min(j0 + block, n_cols);
+                for (uint i = i0; i < i1; ++i) {
+                    const ValueT *src = row_ptr(i);
+                    for (uint j = j0; j < j1; ++j)
+                        dst[j * n_rows + i] = src[j];
+                }
+            }
+        }
+    });
+    return tmp;
+}
+
+template<typename ValueT>
+Matrix<ValueT> Matrix<ValueT>::window(uint rows, uint cols) const
+{
+    Matrix<ValueT> tmp;
+    make_rw(tmp.n_rows) = rows;
+    make_rw(tmp.n_cols) = cols;
+    make_rw(tmp.stride) = stride;
+    // aliasing constructor with empty owner: pointer without control block,
+    // so copying the window doesn't touch any reference counter.
+    tmp._data = std::shared_ptr<ValueT>(std::shared_ptr<ValueT>(),
+                                        _data.get() + pin_row * stride + pin_col);
+    return tmp;
+}
+
+template<typename ValueT>
+inline
+void Matrix<ValueT>::move_window(uint row, uint col)
+{
+    make_rw(pin_row) = row;
+    make_rw(pin_col) = col;
+}
+
+// Coordinate inside [0, len) which is used for coord by border mode.
+// Returns -1 if element is outside (BorderMode::CONSTANT).
+inline
+int border_coord(int coord, int len, BorderMode border)
+{
+    if (coord >= 0 and coord < len)
+        return coord;
+    switch (border) {
+    case BorderMode::REFLECT: {
+        // reflection has period of 2 * len: abcd|dcba|abcd...
+        int period = 2 * len;
+        int pos = (coord % period + period) % period;
+        return pos < len ? pos : period - 1 - pos;
+    }
+    case BorderMode::REPLICATE:
+        return coord < 0 ? 0 : len - 1;
+    case BorderMode::WRAP:
+        return (coord % len + len) % len;
+    default:
+        return -1;
+    }
+}
+
+template<typename ValueT>
+void Matrix<ValueT>::fill_border_neighbourhood(Matrix<ValueT> &dst, int row, int col,
+                                               BorderMode border, const ValueT &border_value) const
+{
+    for (uint i = 0; i < dst.n_rows; ++i) {
+        ValueT *dst_row = dst.row_ptr(i);
+        int src_i = border_coord(row + static_cast<int>(i), n_rows, border);
+        if (src_i < 0) {
+            std::fill(dst_row, dst_row + dst.n_cols, border_value);
+            continue;
+        }
+        const ValueT *src_row = row_ptr(src_i);
+        for (uint j = 0; j < dst.n_cols; ++j) {
+            int src_j = border_coord(col + static_cast<int>(j), n_cols, border);
+            dst_row[j] = src_j < 0 ? border_value : src_row[src_j];
+        }
+    }
+}
+
 template<typename ValueT>
 template<typename UnaryMatrixOperator>
-Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
-Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op) const
+uint Matrix<ValueT>::unary_map_bands(const UnaryMatrixOperator &op, ExecutionPolicy policy,
+                                     BorderMode border) const
+{
+    const bool fits = op.n_rows <= n_rows and op.n_cols <= n_cols;
+    if (policy == ExecutionPolicy::SEQUENTIAL or (border == BorderMode::NONE and not fits))
+        return 1;
+    // band must have enough work to pay for passing it to other thread.
+    const uint min_band_work = 1 << 16;
+    const uint row_work = std::max<uint>(n_cols * op.n_rows * op.n_cols, 1);
+    const uint min_band = std::max<uint>(min_band_work / row_work, 1);
+    const uint rows = border == BorderMode::NONE ? n_rows - op.n_rows + 1 : n_rows;
+    const uint max_bands = 4 * ThreadPool::global().size();
+    return std::max<uint>(std::min(rows / min_band, max_bands), 1);
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+typename Matrix<ValueT>::template unary_map_result<UnaryMatrixOperator>
+Matrix<ValueT>::unary_map_impl(const std::vector<UnaryMatrixOperator*> &bandOps,
+                               BorderMode border, const ValueT &border_value) const
 {
     // Let's typedef return type of function for ease of usage
-    typedef typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type ReturnT;
+    typedef typename unary_map_result<UnaryMatrixOperator>::value_type ReturnT;
+    const auto &op = *bandOps.front();
     if (n_cols * n_rows == 0)
         return Matrix<ReturnT>(0, 0);
 
     if (op.n_cols % 2 == 0 || op.n_rows % 2 == 0)
         throw std::string("can not apply operator with with even size of matrix");
 
-    Matrix<ReturnT> tmp(n_rows, n_cols);
+    // with border mode every pixel is computed.
+    Matrix<ReturnT> tmp = border == BorderMode::NONE ? Matrix<ReturnT>(n_rows, n_cols)
+                                                     : Matrix<ReturnT>::uninitialized(n_rows, n_cols);
+
+    // operator doesn't fit in matrix: there are no pixels with
+    // full neighbourhood.
+    const bool fits = op.n_rows <= n_rows and op.n_cols <= n_cols;
+    if (border == BorderMode::NONE and not fits)
+        return tmp;
 
-    const auto start_i = op.n_rows / 2;
-    const auto end_i = n_rows - op.n_rows / 2;
-    const auto start_j = op.n_cols / 2;
-    const auto end_j = n_cols - op.n_cols / 2;
+    const uint radius_i = op.n_rows / 2;
+    const uint radius_j = op.n_cols / 2;
+    const uint end_i = fits ? n_rows - radius_i : 0;
+    const uint end_j = fits ? n_cols - radius_j : 0;
+    // without border mode only pixels with full neighbourhood are computed.
+    const uint first = border == BorderMode::NONE ? radius_i : 0;
+    const uint rows = border == BorderMode::NONE ? end_i - radius_i : n_rows;
+    const uint bands = bandOps.size();
 
-    for (uint i = start_i; i < end_i; ++i) {
-        for (uint j = start_j; j < end_j; ++j) {
-            auto neighbourhood = submatrix(i - op.n_rows / 2, j - op.n_cols / 2, op.n_rows, op.n_cols);
-            tmp(i, j) = op(neighbourhood);
+    auto process_band = [&] (uint band) {
+        auto &band_op = *bandOps[band];
+        auto neighbourhood = window(band_op.n_rows, band_op.n_cols);
+        // buffer for neighbourhoods crossing the border, reused by band.
+        Matrix<ValueT> outer;
+        if (border != BorderMode::NONE)
+            outer = Matrix<ValueT>(band_op.n_rows, band_op.n_cols);
+        auto process_outer = [&] (uint i, uint j) {
+            fill_border_neighbourhood(outer, static_cast<int>(i) - static_cast<int>(radius_i),
+                                      static_cast<int>(j) - static_cast<int>(radius_j),
+                                      border, border_value);
+            return band_op(outer);
+        };
+
+        const uint begin = first + rows * band / bands;
+        const uint end = first + rows * (band + 1) / bands;
+        for (uint i = begin; i < end; ++i) {
+            ReturnT *dst = tmp.row_ptr(i);
+            if (i < radius_i or i >= end_i) {
+                for (uint j = 0; j < n_cols; ++j)
+                    dst[j] = process_outer(i, j);
+                continue;
+            }
+            for (uint j = radius_j; j < end_j; ++j) {
+                neighbourhood.move_window(i - radius_i, j - radius_j);
+                dst[j] = band_op(neighbourhood);
+            }
+            if (border != BorderMode::NONE) {
+                for (uint j = 0; j < radius_j; ++j)
+                    dst[j] = process_outer(i, j);
+                for (uint j = end_j; j < n_cols; ++j)
+                    dst[j] = process_outer(i, j);
+            }
         }
+    };
+
+    if (bands == 1) {
+        process_band(0);
+    } else {
+        ThreadPool::global().parallelFor(0, bands, 1, [&process_band] (size_t begin, size_t end) {
+            for (size_t band = begin; band < end; ++band)
+                process_band(band);
+        });
     }
 
     return tmp;
@@ -205,29 +472,171 @@ Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op) const
 template<typename ValueT>
 template<typename UnaryMatrixOperator>
 Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
-Matrix<ValueT>::unary_map(UnaryMatrixOperator &op) const
+Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op, ExecutionPolicy policy) const
 {
-    // Let's typedef return type of function for ease of usage
-    typedef typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type ReturnT;
-    if (n_cols * n_rows == 0)
+    return unary_map(op, BorderMode::NONE, ValueT(), policy);
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+Matrix<ValueT>::unary_map(UnaryMatrixOperator &op, ExecutionPolicy policy) const
+{
+    return unary_map(op, BorderMode::NONE, ValueT(), policy);
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op, BorderMode border,
+                          const ValueT &border_value, ExecutionPolicy policy) const
+{
+    std::vector<const UnaryMatrixOperator*> bandOps(unary_map_bands(op, policy, border), &op);
+    return unary_map_impl(bandOps, border, border_value);
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+Matrix<ValueT>::unary_map(UnaryMatrixOperator &op, BorderMode border,
+                          const ValueT &border_value, ExecutionPolicy policy) const
+{
+    return unary_map_mutable(op, policy, border, border_value, has_merge_hook<UnaryMatrixOperator>());
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+typename Matrix<ValueT>::template unary_map_result<UnaryMatrixOperator>
+Matrix<ValueT>::unary_map_mutable(UnaryMatrixOperator &op, ExecutionPolicy policy,
+                                  BorderMode border, const ValueT &border_value, std::true_type) const
+{
+    const uint bands = unary_map_bands(op, policy, border);
+    std::vector<UnaryMatrixOperator> clones(bands - 1, op);
+    std::vector<UnaryMatrixOperator*> bandOps(1, &op);
+    for (auto &clone : clones)
+        bandOps.push_back(&clone);
+
+    auto res = unary_map_impl(bandOps, border, border_value);
+
+    for (const auto &clone : clones)
+        op.merge(clone);
+    return res;
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+typename Matrix<ValueT>::template unary_map_result<UnaryMatrixOperator>
+Matrix<ValueT>::unary_map_mutable(UnaryMatrixOperator &op, ExecutionPolicy,
+                                  BorderMode border, const ValueT &border_value, std::false_type) const
+{
+    return unary_map_impl(std::vector<UnaryMatrixOperator*>(1, &op), border, border_value);
+}
+
+// Check that all matrices given to nary_map have size of the first one.
+template<typename ValueT>
+void nary_map_check_sizes(const Matrix<ValueT> &)
+{
+}
+
+template<typename ValueT, typename ValueT2, typename... ValueTs>
+void nary_map_check_sizes(const Matrix<ValueT> &first, const Matrix<ValueT2> &second,
+                          const Matrix<ValueTs>&... rest)
+{
+    if (first.n_rows != second.n_rows or first.n_cols != second.n_cols)
+        throw std::string("can not map matrices of different sizes");
+    nary_map_check_sizes(first, rest...);
+}
+
+// Elementwise operator applied to one row.
+template<typename NaryOperator, typename ReturnT, typename... ValueTs>
+inline
+void nary_map_row(const NaryOperator &op, ReturnT *__restrict__ dst, uint cols,
+                  const ValueTs *... srcs)
+{
+#pragma GCC ivdep
+    for (uint j = 0; j < cols; ++j)
+        dst[j] = op(srcs[j]...);
+}
+
+template<typename NaryOperator, typename ValueT, typename... ValueTs>
+nary_map_result<NaryOperator, ValueT, ValueTs...>
+nary_map_impl(const NaryOperator &op, std::false_type,
+              const Matrix<ValueT> &first, const Matrix<ValueTs>&... rest)
+{
+    typedef typename nary_map_result<NaryOperator, ValueT, ValueTs...>::value_type ReturnT;
+    nary_map_check_sizes(first, rest...);
+
+    Matrix<ReturnT> tmp = Matrix<ReturnT>::uninitialized(first.n_rows, first.n_cols);
+    const uint cols = first.n_cols;
+    if (cols == 0)
+        return tmp;
+
+    const uint min_band = std::max<uint>((1 << 16) / cols, 1);
+    ThreadPool::global().parallelFor(0, first.n_rows, min_band, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            nary_map_row(op, tmp.row_ptr(i), cols, first.row_ptr(i), rest.row_ptr(i)...);
+    });
+
+    return tmp;
+}
+
+template<typename NaryOperator, typename ValueT, typename... ValueTs, size_t... Is>
+nary_map_result<NaryOperator, ValueT, ValueTs...>
+nary_map_stencil(const NaryOperator &op, std::index_sequence<Is...>,
+                 const Matrix<ValueT> &first, const Matrix<ValueTs>&... rest)
+{
+    typedef typename nary_map_result<NaryOperator, ValueT, ValueTs...>::value_type ReturnT;
+    nary_map_check_sizes(first, rest...);
+
+    if (first.n_cols * first.n_rows == 0)
         return Matrix<ReturnT>(0, 0);
 
     if (op.n_cols % 2 == 0 || op.n_rows % 2 == 0)
         throw std::string("can not apply operator with with even size of matrix");
 
-    Matrix<ReturnT> tmp(n_rows, n_cols);
+    Matrix<ReturnT> tmp(first.n_rows, first.n_cols);
+    if (op.n_rows > first.n_rows || op.n_cols > first.n_cols)
+        return tmp;
 
-    const auto start_i = op.n_rows / 2;
-    const auto end_i = n_rows - op.n_rows / 2;
-    const auto start_j = op.n_cols / 2;
-    const auto end_j = n_cols - op.n_cols / 2;
+    const uint radius_i = op.n_rows / 2;
+    const uint radius_j = op.n_cols / 2;
+    const uint end_i = first.n_rows - radius_i;
+    const uint end_j = first.n_cols - radius_j;
+    const uint min_band = std::max<uint>((1 << 16) / (first.n_cols * op.n_rows * op.n_cols), 1);
 
-    for (uint i = start_i; i < end_i; ++i) {
-        for (uint j = start_j; j < end_j; ++j) {
-            auto neighbourhood = submatrix(i - op.n_rows / 2, j - op.n_cols / 2, op.n_rows, op.n_cols);
-            tmp(i, j) = op(neighbourhood);
+    ThreadPool::global().parallelFor(radius_i, end_i, min_band, [&] (size_t begin, size_t end) {
+        auto windows = std::make_tuple(MatrixWindows::window(first, op.n_rows, op.n_cols),
+                                       MatrixWindows::window(rest, op.n_rows, op.n_cols)...);
+        for (uint i = begin; i < end; ++i) {
+            ReturnT *dst = tmp.row_ptr(i);
+            for (uint j = radius_j; j < end_j; ++j) {
+                int expand[] = {(MatrixWindows::move_window(std::get<Is>(windows), i - radius_i, j - radius_j), 0)...};
+                (void)expand;
+                dst[j] = op(std::get<Is>(windows)...);
+            }
         }
-    }
+    });
 
     return tmp;
 }
+
+template<typename NaryOperator, typename... ValueTs>
+nary_map_result<NaryOperator, ValueTs...>
+nary_map_impl(const NaryOperator &op, std::true_type, const Matrix<ValueTs>&... matrices)
+{
+    return nary_map_stencil(op, std::index_sequence_for<ValueTs...>(), matrices...);
+}
+
+template<typename NaryOperator, typename... ValueTs>
+nary_map_result<NaryOperator, ValueTs...>
+nary_map(const NaryOperator &op, const Matrix<ValueTs>&... matrices)
+{
+    return nary_map_impl(op, is_stencil_operator<NaryOperator>(), matrices...);
+}
+
+template<typename BinaryMatrixOperator, typename ValueT1, typename ValueT2>
+nary_map_result<BinaryMatrixOperator, ValueT1, ValueT2>
+binary_map(const BinaryMatrixOperator &op, const Matrix<ValueT1> &m1, const Matrix<ValueT2> &m2)
+{
+    return nary_map(op, m1, m2);
+}
@@ -23,7 +23,8 @@ namespace ConsoleViews {
                 (*logFile) << "image was diveded on channels" << std::endl;
             } else if (notification.getType() == getNotificationType<ImagesWasCropped>()) {
                 (*logFile) << "image was cropped" << std::endl;
-            } else if (notification.getType() == getNotificationType<ImagesWasAligned>()) {
+            } else if (notification.getType() == getNotificationType<ImagesWasAligned>() ||
+                       notification.getType() == getNotificationType<ImagesWasAlignedToFile>()) {
                 (*logFile) << "image was aligned" << std::endl;
             } else if (notification.getType() == getNotificationType<ImageResultWasProcessed>()) {
                 (*logFile) << "image was postprocessing" << std::endl;
@@ -43,9 +44,9 @@ namespace ConsoleViews {
 
         void applyNotification(const NotificationBase& notification) override {
             if (notification.getType() == getNotificationType<ImagesWasAligned>()) {
-                save_image(model->getResultImage(), resultPath);
+                save();
             } else if (notification.getType() == getNotificationType<ImageResultWasProcessed>()) {
-                save_image(model->getResultImage(), resultPath);
+                save();
             }
         }
 
@@ -54,5 +55,12 @@ namespace ConsoleViews {
     private:
         const Model* model;
         const char* resultPath;
+
+        void save() const {
+            if (is_tiff_path(resultPath))
+                save_tiff(model->getResultImage16(), resultPath);
+            else
+                save_image(model->getResultImage(), resultPath);
+        }
     };
 }
@@ -22,6 +22,11 @@ class ImagesWasAligned : public NotificationBase {
     DECLARE_NOTIFICATION
 };
 
+// Result was written straight to file by streaming alignment.
+class ImagesWasAlignedToFile : public NotificationBase {
+    DECLARE_NOTIFICATION
+};
+
 class ImageResultWasProcessed : public NotificationBase {
     DECLARE_NOTIFICATION
 };
@@ -32,18 +37,43 @@ public:
 
     void align(const Image& srcImage, bool isInterp, bool isSubpixel, double subScale);
 
+    // Align grayscale plate given as a single plane.
+    void align(const Plane8& srcPlate, bool isInterp, bool isSubpixel, double subScale);
+
+    // Align 16-bit plate (scans from TIFF files). Result keeps 16-bit
+    // samples, getResultImage gives them reduced to 8 bits.
+    void align(const Plane16& srcPlate, bool isInterp, bool isSubpixel, double subScale);
+
+    // Estimated peak memory of align for plate described by info.
+    static size_t alignMemoryCost(const ImageInfo& info);
+
+    // Align plate from file and write result to dstImageName by bands of
+    // rows, peak memory doesn't depend on size of plate. Result image is
+    // not kept in model.
+    void alignStreaming(const char *srcImageName, const char *dstImageName);
+
     Image getResultImage() const {
         if (resImage.n_rows > 0 && resImage.n_cols > 0)
             return resImage;
         throw std::string("resImage no exist");
     }
 
+    // Result with 16-bit samples, 8-bit result is scaled to 16 bits.
+    PlanarImage16 getResultImage16() const;
+
+    // Filters work on 8-bit result, 16-bit one is dropped.
     template <typename Filter>
     void processResult(const Filter& filter) {
-        resImage = filter.applyToImage(resImage).deep_copy();
+        resImage = filter.applyToImage(resImage).materialize();
+        resImage16 = {};
         notifyObservers(ImageResultWasProcessed());
     }
 
 private:
+    // Align thirds of plate (blue, green, red).
+    template <typename ChannelT>
+    PlanarImage<ChannelT> alignChannels(std::vector<Matrix<ChannelT>> images, bool isInterp, bool isSubpixel, double subScale);
+
     Image resImage{};
+    PlanarImage16 resImage16{};
 };
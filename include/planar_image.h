@@ -0,0 +1,258 @@
+#pragma once
+
+#include "matrix.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+
+// Single channel of an image, one sample per element.
+typedef Matrix<uint8_t> Plane8;
+typedef Matrix<uint16_t> Plane16;
+
+// Uniform access to channels of a pixel, so algorithms can be written once
+// for interleaved RGB images and for single planes.
+//
+// Plain scalar pixel is a pixel with one channel, its samples are
+// unsigned integers, which use the whole range of their type.
+template <typename PixelT, uint MaxValue = std::numeric_limits<PixelT>::max()>
+struct ScalarPixelTraits {
+    static_assert(std::is_integral<PixelT>::value && std::is_unsigned<PixelT>::value,
+                  "samples of scalar pixel must be unsigned integers");
+
+    static const size_t channels = 1;
+    // Largest value of channel, results of filters are clamped to it.
+    static const uint maxValue = MaxValue;
+
+    static uint get(const PixelT& pixel, size_t /*channel*/) {
+        return pixel;
+    }
+
+    static void set(PixelT& pixel, size_t /*channel*/, uint val) {
+        pixel = val;
+    }
+};
+
+template <typename PixelT>
+struct PixelTraits : ScalarPixelTraits<PixelT> {};
+
+template <>
+struct PixelTraits<uint8_t> : ScalarPixelTraits<uint8_t, 255> {};
+
+template <>
+struct PixelTraits<std::tuple<uint, uint, uint>> {
+    static const size_t channels = 3;
+    static const uint maxValue = 255;
+
+    static uint get(const std::tuple<uint, uint, uint>& pixel, size_t channel) {
+        return channel == 0 ? std::get<0>(pixel) : channel == 1 ? std::get<1>(pixel) : std::get<2>(pixel);
+    }
+
+    static void set(std::tuple<uint, uint, uint>& pixel, size_t channel, uint val) {
+        if (channel == 0)
+            std::get<0>(pixel) = val;
+        else if (channel == 1)
+            std::get<1>(pixel) = val;
+        else
+            std::get<2>(pixel) = val;
+    }
+};
+
+// Value of the first channel of a pixel. Alignment works on grayscale
+// plates, so it is the only channel it looks at.
+template <typename PixelT>
+inline uint channelValue(const PixelT& pixel) {
+    return PixelTraits<PixelT>::get(pixel, 0);
+}
+
+// Image stored as three separate contiguous planes (red, green, blue).
+// Compared to Matrix<std::tuple<uint, uint, uint>> 8-bit planar image
+// takes 3 bytes per pixel instead of 12 and every plane can be processed
+// as a plain array of samples.
+template <typename ChannelT>
+class PlanarImage {
+public:
+    PlanarImage(uint row_count = 0, uint col_count = 0)
+        : red(row_count, col_count), green(row_count, col_count), blue(row_count, col_count) {}
+
+    PlanarImage(const Matrix<ChannelT>& red_, const Matrix<ChannelT>& green_, const Matrix<ChannelT>& blue_)
+        : red(red_), green(green_), blue(blue_)
+    {
+        if (red.n_rows != green.n_rows || red.n_rows != blue.n_rows ||
+            red.n_cols != green.n_cols || red.n_cols != blue.n_cols)
+            throw std::string("planes of image must have equal size");
+    }
+
+    uint n_rows() const {
+        return red.n_rows;
+    }
+
+    uint n_cols() const {
+        return red.n_cols;
+    }
+
+    // Plane by channel index: 0 - red, 1 - green, 2 - blue.
+    Matrix<ChannelT>& plane(size_t channel) {
+        return channel == 0 ? red : channel == 1 ? green : blue;
+    }
+
+    const Matrix<ChannelT>& plane(size_t channel) const {
+        return channel == 0 ? red : channel == 1 ? green : blue;
+    }
+
+    Matrix<ChannelT> red, green, blue;
+};
+
+typedef PlanarImage<uint8_t> PlanarImage8;
+typedef PlanarImage<uint16_t> PlanarImage16;
+
+// Read-only view of one channel: a plane, or one component of every pixel
+// of interleaved image, without copying. Samples of a row are sampleStride
+// elements apart, rows are rowStride elements apart. View keeps data of
+// viewed matrix alive.
+//
+// Views of planes (and of their submatrices, like thirds of a plate) are
+// packed: packedRow gives contiguous samples of a row and toPlane returns
+// the plane itself.
+//
+// ChannelView<uint> green(image, 1);
+// Plane8 plane = green.toPlane<uint8_t>();
+template <typename SampleT>
+class ChannelView {
+public:
+    explicit ChannelView(const Matrix<SampleT>& plane_)
+        : rows(plane_.n_rows), cols(plane_.n_cols), plane(plane_), owner(),
+          data(rows != 0 && cols != 0 ? plane_.row_ptr(0) : nullptr), sampleStride(1), rowStride(plane_.row_stride()) {}
+
+    // View of channel of interleaved image (Image), SampleT must be uint.
+    ChannelView(const Matrix<std::tuple<uint, uint, uint>>& image, size_t channel)
+        : rows(image.n_rows), cols(image.n_cols), plane(), owner(std::make_shared<Matrix<std::tuple<uint, uint, uint>>>(image)),
+          data(nullptr), sampleStride(sizeof(std::tuple<uint, uint, uint>) / sizeof(SampleT)),
+          rowStride(image.row_stride() * sampleStride)
+    {
+        static_assert(std::is_same<SampleT, uint>::value, "channels of Image are uint");
+        if (channel >= 3)
+            throw std::string("no such channel");
+        if (rows * cols != 0) {
+            const auto& pixel = *image.row_ptr(0);
+            data = channel == 0 ? &std::get<0>(pixel) : channel == 1 ? &std::get<1>(pixel) : &std::get<2>(pixel);
+        }
+    }
+
+    ChannelView(const ChannelView&) = default;
+    ChannelView& operator = (const ChannelView&) = default;
+
+    uint n_rows() const {
+        return rows;
+    }
+
+    uint n_cols() const {
+        return cols;
+    }
+
+    SampleT operator () (uint row, uint col) const {
+        if (row >= rows || col >= cols)
+            throw std::string("Out of bounds");
+        return data[row * rowStride + col * sampleStride];
+    }
+
+    // True if samples of every row are contiguous.
+    bool isPacked() const {
+        return sampleStride == 1;
+    }
+
+    // Contiguous samples of row of packed view.
+    const SampleT* packedRow(uint row) const {
+        if (!isPacked())
+            throw std::string("channel view is not packed");
+        return data + row * rowStride;
+    }
+
+    ChannelView submatrix(uint prow, uint pcol, uint rows_, uint cols_) const {
+        if (prow + rows_ > rows || pcol + cols_ > cols)
+            throw std::string("Out of bounds");
+        ChannelView res(*this);
+        res.rows = rows_;
+        res.cols = cols_;
+        if (isPacked())
+            res.plane = plane.submatrix(prow, pcol, rows_, cols_);
+        if (rows_ * cols_ != 0)
+            res.data = data + prow * rowStride + pcol * sampleStride;
+        return res;
+    }
+
+    // Channel as a plane with samples of type T. View of plane
+    // with the same type of samples gives that plane without copying.
+    template <typename T = SampleT>
+    Matrix<T> toPlane() const {
+        return toPlane<T>(std::is_same<T, SampleT>());
+    }
+
+private:
+    uint rows, cols;
+    // Viewed plane, if view is packed.
+    Matrix<SampleT> plane;
+    // Viewed interleaved image otherwise.
+    std::shared_ptr<const void> owner;
+    const SampleT* data;
+    size_t sampleStride, rowStride;
+
+    template <typename T>
+    Matrix<T> toPlane(std::true_type) const {
+        return isPacked() ? plane : toPlane<T>(std::false_type());
+    }
+
+    template <typename T>
+    Matrix<T> toPlane(std::false_type) const {
+        Matrix<T> res(rows, cols);
+        const size_t minBand = std::max<size_t>((1 << 16) / std::max<uint>(cols, 1), 1);
+        ThreadPool::global().parallelFor(0, rows, minBand, [&] (size_t begin, size_t end) {
+            for (size_t row = begin; row < end; ++row) {
+                const SampleT* src = data + row * rowStride;
+                T* dst = res.row_ptr(row);
+                for (uint col = 0; col < cols; ++col)
+                    dst[col] = src[col * sampleStride];
+            }
+        });
+        return res;
+    }
+};
+
+// Copy one channel of interleaved image to a separate plane.
+// Samples are stored as is, without scaling.
+template <typename ChannelT>
+Matrix<ChannelT> extractPlane(const Matrix<std::tuple<uint, uint, uint>>& image, size_t channel) {
+    return ChannelView<uint>(image, channel).toPlane<ChannelT>();
+}
+
+// Convert interleaved image (Image) to planar representation.
+template <typename ChannelT>
+PlanarImage<ChannelT> toPlanar(const Matrix<std::tuple<uint, uint, uint>>& image) {
+    return PlanarImage<ChannelT>(extractPlane<ChannelT>(image, 0),
+                                 extractPlane<ChannelT>(image, 1),
+                                 extractPlane<ChannelT>(image, 2));
+}
+
+// Convert planar image back to interleaved representation (Image).
+template <typename ChannelT>
+Matrix<std::tuple<uint, uint, uint>> toImage(const PlanarImage<ChannelT>& image) {
+    Matrix<std::tuple<uint, uint, uint>> res(image.n_rows(), image.n_cols());
+    const uint cols = res.n_cols;
+    const size_t minBand = std::max<size_t>((1 << 16) / std::max<uint>(cols, 1), 1);
+    ThreadPool::global().parallelFor(0, res.n_rows, minBand, [&] (size_t begin, size_t end) {
+        for (size_t row = begin; row < end; ++row) {
+            const ChannelT* red = image.red.row_ptr(row);
+            const ChannelT* green = image.green.row_ptr(row);
+            const ChannelT* blue = image.blue.row_ptr(row);
+            auto* dst = res.row_ptr(row);
+            for (uint col = 0; col < cols; ++col)
+                dst[col] = std::make_tuple(red[col], green[col], blue[col]);
+        }
+    });
+    return res;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sums over pairs of contiguous rows of 8-bit or 16-bit samples, the
+// innermost loops of shift search: sum of squared differences (SSD),
+// dot product and sum of absolute differences (SAD).
+//
+// On x86 SSE2 or AVX2 version is chosen at first call by CPU features,
+// other platforms use scalar loops. All versions give exactly the same
+// results, sums are 64-bit.
+//
+// uint64_t ssd = rowSquaredDiff(plane1.row_ptr(r), plane2.row_ptr(r), plane1.n_cols);
+
+// Instruction set used by kernels, from worst to best.
+enum class SimdLevel {
+    SCALAR, SSE2, AVX2
+};
+
+// Best level supported by current CPU.
+SimdLevel supportedSimdLevel();
+
+// Level used by kernels now, supportedSimdLevel() by default.
+SimdLevel simdLevel();
+
+// Use given level (e.g. to compare versions), it is clamped to
+// supportedSimdLevel(). Not thread safe against running kernels.
+void setSimdLevel(SimdLevel level);
+
+uint64_t rowSquaredDiff(const uint8_t* row1, const uint8_t* row2, size_t count);
+uint64_t rowSquaredDiff(const uint16_t* row1, const uint16_t* row2, size_t count);
+
+uint64_t rowDot(const uint8_t* row1, const uint8_t* row2, size_t count);
+uint64_t rowDot(const uint16_t* row1, const uint16_t* row2, size_t count);
+
+uint64_t rowAbsDiff(const uint8_t* row1, const uint8_t* row2, size_t count);
+uint64_t rowAbsDiff(const uint16_t* row1, const uint16_t* row2, size_t count);
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// How data-parallel functions (like Matrix::unary_map) should run.
+enum class ExecutionPolicy {
+    SEQUENTIAL, PARALLEL
+};
+
+// Fixed set of worker threads executing queued tasks.
+//
+// Usually global pool is used:
+// ThreadPool::global().parallelFor(0, n_rows, 16, [&] (size_t begin, size_t end) {
+//     for (size_t row = begin; row < end; ++row)
+//         processRow(row);
+// });
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threadsCount) : workers(), tasks(), mutex(), hasTask(), stopping(false) {
+        for (size_t i = 0; i < threadsCount; ++i)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        hasTask.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // Pool shared by all library functions, one thread per core.
+    static ThreadPool& global() {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    // Split [begin, end) into consecutive bands of at least minBand elements
+    // and call func(bandBegin, bandEnd) for every band on pool threads.
+    // Returns when all bands are processed; exception thrown by func
+    // is rethrown here.
+    //
+    // Called from a worker of the pool (nested parallelism) or with
+    // one band, func is just called in current thread.
+    template <typename Func>
+    void parallelFor(size_t begin, size_t end, size_t minBand, Func func) {
+        if (begin >= end)
+            return;
+        size_t bandsCount = std::min((end - begin) / std::max<size_t>(minBand, 1), 4 * size());
+        if (bandsCount <= 1 || isWorkerThread()) {
+            func(begin, end);
+            return;
+        }
+
+        std::vector<std::future<void>> results;
+        size_t bandBegin = begin;
+        for (size_t band = 0; band < bandsCount; ++band) {
+            size_t bandEnd = begin + (end - begin) * (band + 1) / bandsCount;
+            results.push_back(submit([&func, bandBegin, bandEnd] { func(bandBegin, bandEnd); }));
+            bandBegin = bandEnd;
+        }
+        for (auto& result : results)
+            result.wait();
+        for (auto& result : results)
+            result.get();
+    }
+
+    // Queue task for execution, result tells when it is done.
+    std::future<void> submit(std::function<void()> task) {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+        auto result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([packaged] { (*packaged)(); });
+        }
+        hasTask.notify_one();
+        return result;
+    }
+
+    // True if current thread is a worker of some pool.
+    static bool isWorkerThread() {
+        return workerFlag();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable hasTask;
+    bool stopping;
+
+    static bool& workerFlag() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    void workerLoop() {
+        workerFlag() = true;
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                hasTask.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
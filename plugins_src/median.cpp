@@ -9,15 +9,16 @@ public:
     MedianSimpleFilter(size_t radius_) : radius(radius_) {}
 
     Image applyToImage(const Image& image) const override {
-        Image ans = image.deep_copy();
+        Image ans = image.copy();
         for (size_t row = radius; row < image.n_rows - radius; ++row) {
             for (size_t col = radius; col < image.n_cols - radius; ++col) {
                 std::vector<size_t> valuesR, valuesG, valuesB;
                 for (int dr = -radius; dr <= static_cast<int>(radius); ++dr) {
+                    const auto* src = image.row_ptr(row + dr) + col;
                     for (int dc = -radius; dc <= static_cast<int>(radius); ++dc) {
-                        valuesR.push_back(std::get<0>(image(row + dr, col + dc)));
-                        valuesG.push_back(std::get<1>(image(row + dr, col + dc)));
-                        valuesB.push_back(std::get<2>(image(row + dr, col + dc)));
+                        valuesR.push_back(std::get<0>(src[dc]));
+                        valuesG.push_back(std::get<1>(src[dc]));
+                        valuesB.push_back(std::get<2>(src[dc]));
                     }
                 }
 
@@ -28,7 +29,7 @@ public:
                 std::nth_element(valuesB.begin(), valuesB.begin() + valuesB.size() / 2, valuesB.end());
                 auto valB = valuesB[valuesB.size() / 2];
 
-                ans(row, col) = std::make_tuple(valR, valG, valB);
+                ans.row_ptr(row)[col] = std::make_tuple(valR, valG, valB);
             }
         }
         return ans;
@@ -44,9 +45,9 @@ public:
 
     Image applyToImage(const Image& image) const override {
         if (2 * radius + 1 > image.n_rows || 2 * radius + 1 > image.n_cols)
-            return image.deep_copy();
+            return image.copy();
 
-        Image ans = image.deep_copy();
+        Image ans = image.copy();
 
         Histogram histR, histG, histB;
 
@@ -57,23 +58,27 @@ public:
                     histG.clear();
                     histB.clear();
                     for (int dr = -static_cast<int>(radius); dr <= static_cast<int>(radius); ++dr) {
+                        const auto* src = image.row_ptr(row + dr) + col;
                         for (int dc = -static_cast<int>(radius); dc <= static_cast<int>(radius); ++dc) {
-                            histR.add(std::get<0>(image(row + dr, col + dc)));
-                            histG.add(std::get<1>(image(row + dr, col + dc)));
-                            histB.add(std::get<2>(image(row + dr, col + dc)));
+                            histR.add(std::get<0>(src[dc]));
+                            histG.add(std::get<1>(src[dc]));
+                            histB.add(std::get<2>(src[dc]));
                         }
                     }
                 } else {
                     for (int dr = -static_cast<int>(radius); dr <= static_cast<int>(radius); ++dr) {
-                        histR.remove(std::get<0>(image(row + dr, col - radius - 1)));
-                        histG.remove(std::get<1>(image(row + dr, col - radius - 1)));
-                        histB.remove(std::get<2>(image(row + dr, col - radius - 1)));
-                        histR.add(std::get<0>(image(row + dr, col + radius)));
-                        histG.add(std::get<1>(image(row + dr, col + radius)));
-                        histB.add(std::get<2>(image(row + dr, col + radius)));
+                        const auto* src = image.row_ptr(row + dr);
+                        const auto& removed = src[col - radius - 1];
+                        const auto& added = src[col + radius];
+                        histR.remove(std::get<0>(removed));
+                        histG.remove(std::get<1>(removed));
+                        histB.remove(std::get<2>(removed));
+                        histR.add(std::get<0>(added));
+                        histG.add(std::get<1>(added));
+                        histB.add(std::get<2>(added));
                     }
                 }
-                ans(row, col) = std::make_tuple(histR.findMedian(), histG.findMedian(), histB.findMedian());
+                ans.row_ptr(row)[col] = std::make_tuple(histR.findMedian(), histG.findMedian(), histB.findMedian());
             }
         }
 
@@ -90,30 +95,33 @@ public:
 
     Image applyToImage(const Image& image) const override {
         if (2 * radius + 1 > image.n_rows || 2 * radius + 1 > image.n_cols)
-            return image.deep_copy();
+            return image.copy();
 
-        Image ans = image.deep_copy();
+        Image ans = image.copy();
 
         std::tuple<Histogram, Histogram, Histogram> kernel;
         std::vector<std::tuple<Histogram, Histogram, Histogram>> vertHists(image.n_cols);
 
-        for (size_t col = 0; col < image.n_cols; ++col) {
-            for (size_t row = 0; row < 2 * radius + 1; ++row) {
-                std::get<0>(vertHists[col]).add(std::get<0>(image(row, col)));
-                std::get<1>(vertHists[col]).add(std::get<1>(image(row, col)));
-                std::get<2>(vertHists[col]).add(std::get<2>(image(row, col)));
+        for (size_t row = 0; row < 2 * radius + 1; ++row) {
+            const auto* src = image.row_ptr(row);
+            for (size_t col = 0; col < image.n_cols; ++col) {
+                std::get<0>(vertHists[col]).add(std::get<0>(src[col]));
+                std::get<1>(vertHists[col]).add(std::get<1>(src[col]));
+                std::get<2>(vertHists[col]).add(std::get<2>(src[col]));
             }
         }
 
         for (size_t row = radius; row < image.n_rows - radius; ++row) {
             if (row != radius) {
+                const auto* removed = image.row_ptr(row - radius - 1);
+                const auto* added = image.row_ptr(row + radius);
                 for (size_t col = 0; col < image.n_cols; ++col) {
-                    std::get<0>(vertHists[col]).remove(std::get<0>(image(row - radius - 1, col)));
-                    std::get<1>(vertHists[col]).remove(std::get<1>(image(row - radius - 1, col)));
-                    std::get<2>(vertHists[col]).remove(std::get<2>(image(row - radius - 1, col)));
-                    std::get<0>(vertHists[col]).add(std::get<0>(image(row + radius, col)));
-                    std::get<1>(vertHists[col]).add(std::get<1>(image(row + radius, col)));
-                    std::get<2>(vertHists[col]).add(std::get<2>(image(row + radius, col)));
+                    std::get<0>(vertHists[col]).remove(std::get<0>(removed[col]));
+                    std::get<1>(vertHists[col]).remove(std::get<1>(removed[col]));
+                    std::get<2>(vertHists[col]).remove(std::get<2>(removed[col]));
+                    std::get<0>(vertHists[col]).add(std::get<0>(added[col]));
+                    std::get<1>(vertHists[col]).add(std::get<1>(added[col]));
+                    std::get<2>(vertHists[col]).add(std::get<2>(added[col]));
                 }
             }
             for (size_t col = radius; col < image.n_cols - radius; ++col) {
@@ -134,7 +142,7 @@ public:
                     std::get<1>(kernel).addHist(std::get<1>(vertHists[col + radius]));
                     std::get<2>(kernel).addHist(std::get<2>(vertHists[col + radius]));
                 }
-                ans(row, col) = std::make_tuple(std::get<0>(kernel).findMedian(), std::get<1>(kernel).findMedian(), std::get<2>(kernel).findMedian());
+                ans.row_ptr(row)[col] = std::make_tuple(std::get<0>(kernel).findMedian(), std::get<1>(kernel).findMedian(), std::get<2>(kernel).findMedian());
             }
         }
 
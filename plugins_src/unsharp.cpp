@@ -33,16 +33,18 @@ Image unMirror(const Image& srcImage, size_t radius) {
     return srcImage.submatrix(radius, radius, srcImage.n_rows - 2 * radius, srcImage.n_cols - 2 * radius);
 }
 
+constexpr FixedKernel<double, 1> unSharpKernel = {{{-1.0 / 6, -2.0 / 3, -1.0 / 6},
+                                                    {-2.0 / 3, 4 + 1.0 / 3, -2.0 / 3},
+                                                    {-1.0 / 6, -2.0 / 3, -1.0 / 6}}};
+
 class UnSharpFilter : public BaseFilterWrapper {
 public:
-    UnSharpFilter() : impl({{-1.0 / 6, -2.0 / 3, -1.0 / 6}, {-2.0 / 3, 4 + 1.0 / 3, -2.0 / 3}, {-1.0 / 6, -2.0 / 3, -1.0 / 6}}) {}
 
     Image applyToImage(const Image& image) const override {
-        return unMirror(mirror(image, 1).unary_map(impl), 1);
+        // same as unMirror(mirror(image, 1).unary_map(impl), 1), but without
+        // copying image twice.
+        return image.unary_map(unSharpKernel, BorderMode::REFLECT);
     }
-
-private:
-    KernelFilterImpl<double> impl;
 };
 
 class UnSharpPlugin : public IFilterPlugin {
@@ -48,26 +48,33 @@ Image gray_world(Image src_image) {
     return ans;
 }
 
-Image bicubicResize(Image srcImage, double scale) {
-    Image resImage(srcImage.n_rows * scale, srcImage.n_cols * scale);
+template <typename PixelT>
+Matrix<PixelT> bicubicResize(const Matrix<PixelT>& srcImage, double scale) {
+    typedef PixelTraits<PixelT> Traits;
+    Matrix<PixelT> resImage(srcImage.n_rows * scale, srcImage.n_cols * scale);
 
     for (size_t row = 0; row < resImage.n_rows; ++row) {
+        double srcRow = 1.0 * row / scale;
+
+        size_t i1 = std::max(static_cast<int>(floor(srcRow)), 0);
+        if (i1 > srcImage.n_rows - 4)
+            i1 = srcImage.n_rows - 4;
+        double y = srcRow - i1;
+
+        const PixelT* src[4] = {srcImage.row_ptr(i1), srcImage.row_ptr(i1 + 1),
+                                srcImage.row_ptr(i1 + 2), srcImage.row_ptr(i1 + 3)};
+        PixelT* dst = resImage.row_ptr(row);
+
         for (size_t col = 0; col < resImage.n_cols; ++col) {
-            double srcRow = 1.0 * row / scale;
             double srcCol = 1.0 * col / scale;
 
-            size_t i1, j1;
-            i1 = std::max(static_cast<int>(floor(srcRow)), 0);
-            if (i1 > srcImage.n_rows - 4)
-                i1 = srcImage.n_rows - 4;
-            j1 = std::max(static_cast<int>(floor(srcCol)), 0);
+            size_t j1 = std::max(static_cast<int>(floor(srcCol)), 0);
             if (j1 > srcImage.n_cols - 4)
                 j1 = srcImage.n_cols - 4;
 
-            double y = srcRow - i1;
             double x = srcCol - j1;
 
-            std::tuple<uint, uint, uint> q[16];
+            PixelT q[16];
             double k[16];
 
             k[0] = 0.25 * (x - 1) * (x - 2) * (x + 1) * (y - 1) * (y - 2) * (y + 1);
@@ -87,68 +94,73 @@ Image bicubicResize(Image srcImage, double scale) {
             k[14] = -1.0 / 36 * x * y * (x - 1) * (x - 2) * (y - 1) * (y + 1);
             k[15] = 1.0 / 36 * x * y * (x - 1) * (x + 1) * (y - 1) * (y + 1);
 
-            q[0] = srcImage(i1 + 1, j1 + 1);
-            q[1] = srcImage(i1 + 1, j1 + 2);
-            q[2] = srcImage(i1 + 2, j1 + 1);
-            q[3] = srcImage(i1 + 2, j1 + 2);
-            q[4] = srcImage(i1 + 1, j1);
-            q[5] = srcImage(i1, j1 + 1);
-            q[6] = srcImage(i1 + 2, j1);
-            q[7] = srcImage(i1, j1 + 2);
-            q[8] = srcImage(i1 + 1, j1 + 3);
-            q[9] = srcImage(i1 + 3, j1);
-            q[10] = srcImage(i1, j1);
-            q[11] = srcImage(i1 + 2, j1 + 3);
-            q[12] = srcImage(i1 + 3, j1 + 2);
-            q[13] = srcImage(i1, j1 + 3);
-            q[14] = srcImage(i1 + 3, j1);
-            q[15] = srcImage(i1 + 3, j1 + 3);
-
-            double valR = 0, valG = 0, valB = 0;
-            for (size_t i = 0; i < 16; ++i) {
-                valR += std::get<0>(q[i]) * k[i];
-                valG += std::get<1>(q[i]) * k[i];
-                valB += std::get<2>(q[i]) * k[i];
+            q[0] = src[1][j1 + 1];
+            q[1] = src[1][j1 + 2];
+            q[2] = src[2][j1 + 1];
+            q[3] = src[2][j1 + 2];
+            q[4] = src[1][j1];
+            q[5] = src[0][j1 + 1];
+            q[6] = src[2][j1];
+            q[7] = src[0][j1 + 2];
+            q[8] = src[1][j1 + 3];
+            q[9] = src[3][j1];
+            q[10] = src[0][j1];
+            q[11] = src[2][j1 + 3];
+            q[12] = src[3][j1 + 2];
+            q[13] = src[0][j1 + 3];
+            q[14] = src[3][j1];
+            q[15] = src[3][j1 + 3];
+
+            for (size_t ch = 0; ch < Traits::channels; ++ch) {
+                double val = 0;
+                for (size_t i = 0; i < 16; ++i)
+                    val += Traits::get(q[i], ch) * k[i];
+                Traits::set(dst[col], ch, normalizeRes(val, Traits::maxValue));
             }
-
-            resImage(row, col) = std::make_tuple(normalizeRes(valR), normalizeRes(valG), normalizeRes(valB));
         }
     }
 
     return resImage;
 }
 
-Image resize(Image srcImage, double scale) {
-    Image resImage(srcImage.n_rows * scale, srcImage.n_cols * scale);
+template <typename PixelT>
+Matrix<PixelT> resize(const Matrix<PixelT>& srcImage, double scale) {
+    typedef PixelTraits<PixelT> Traits;
+    Matrix<PixelT> resImage(srcImage.n_rows * scale, srcImage.n_cols * scale);
 
     for (size_t row = 0; row < resImage.n_rows; ++row) {
+        double srcRow = 1.0 * row / scale;
+
+        size_t i1 = std::max(static_cast<int>(floor(srcRow)), 0);
+        if (i1 > srcImage.n_rows - 2)
+            i1 = srcImage.n_rows - 2;
+
+        const PixelT* src1 = srcImage.row_ptr(i1);
+        const PixelT* src2 = srcImage.row_ptr(i1 + 1);
+        PixelT* dst = resImage.row_ptr(row);
+
         for (size_t col = 0; col < resImage.n_cols; ++col) {
-            double srcRow = 1.0 * row / scale;
             double srcCol = 1.0 * col / scale;
 
-            size_t i1, j1;
-            i1 = std::max(static_cast<int>(floor(srcRow)), 0);
-            if (i1 > srcImage.n_rows - 2)
-                i1 = srcImage.n_rows - 2;
-            j1 = std::max(static_cast<int>(floor(srcCol)), 0);
+            size_t j1 = std::max(static_cast<int>(floor(srcCol)), 0);
             if (j1 > srcImage.n_cols - 2)
                 j1 = srcImage.n_cols - 2;
 
-            std::tuple<uint, uint, uint> q11, q21, q22, q12;
-            q11 = srcImage(i1, j1);
-            q21 = srcImage(i1 + 1, j1);
-            q12 = srcImage(i1, j1 + 1);
-            q22 = srcImage(i1 + 1, j1 + 1);
+            const PixelT& q11 = src1[j1];
+            const PixelT& q21 = src2[j1];
+            const PixelT& q12 = src1[j1 + 1];
+            const PixelT& q22 = src2[j1 + 1];
 
             double k11 = (i1 + 1 - srcRow) * (j1 + 1 - srcCol);
             double k21 = (srcRow - i1) * (j1 + 1 - srcCol);
             double k12 = (i1 + 1 - srcRow) * (srcCol - j1);
             double k22 = (srcRow - i1) * (srcCol - j1);
 
-            resImage(row, col) =
-                std::make_tuple(normalizeRes(std::get<0>(q11) * k11 + std::get<0>(q21) * k21 + std::get<0>(q12) * k12 + std::get<0>(q22) * k22),
-                                normalizeRes(std::get<1>(q11) * k11 + std::get<1>(q21) * k21 + std::get<1>(q12) * k12 + std::get<1>(q22) * k22),
-                                normalizeRes(std::get<2>(q11) * k11 + std::get<2>(q21) * k21 + std::get<2>(q12) * k12 + std::get<2>(q22) * k22));
+            for (size_t ch = 0; ch < Traits::channels; ++ch) {
+                Traits::set(dst[col], ch,
+                            normalizeRes(Traits::get(q11, ch) * k11 + Traits::get(q21, ch) * k21 +
+                                         Traits::get(q12, ch) * k12 + Traits::get(q22, ch) * k22, Traits::maxValue));
+            }
         }
     }
 
@@ -156,8 +168,8 @@ Image resize(Image srcImage, double scale) {
 }
 
 static bool isNoMax(const Matrix<double>& gradLength, const Matrix<double>& gradDirection, size_t row, size_t col) {
-    auto dir = gradDirection(row, col);
-    auto len = gradLength(row, col);
+    auto dir = gradDirection.row_ptr(row)[col];
+    auto len = gradLength.row_ptr(row)[col];
     if (dir < 0)
         dir += M_PI;
     static const std::pair<int, int> dr[5] = {{0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}};
@@ -167,7 +179,7 @@ static bool isNoMax(const Matrix<double>& gradLength, const Matrix<double>& grad
         static const double eps = 0.000000001;
         if (nrow < 0 || nrow >= static_cast<int>(gradLength.n_rows) || ncol < 0 || ncol >= static_cast<int>(gradLength.n_cols))
             return false;
-        return gradLength(nrow, ncol) > len - eps;
+        return gradLength.row_ptr(nrow)[ncol] > len - eps;
     };
 
     size_t id = static_cast<size_t>(dir / stepAngle);
@@ -198,62 +210,77 @@ static void bfs(std::queue<std::pair<size_t, size_t>> q, Matrix<int>& mp) {
     }
 }
 
-Image canny(Image src_image, int threshold1, int threshold2) {
-    Image bluringImage = GaussFilter(2, 1.4).applyToImage(src_image);
+template <typename PixelT>
+BitMask canny(const Matrix<PixelT>& src_image, int threshold1, int threshold2) {
+    Matrix<PixelT> bluringImage = GaussFilter(2, 1.4).apply(src_image);
 
-    Image derivativeX = SobelKernelX().applyToImage(bluringImage);
+    Matrix<PixelT> derivativeX = SobelKernelX().apply(bluringImage);
 
-    Image derivativeY = SobelKernelY().applyToImage(bluringImage);
+    Matrix<PixelT> derivativeY = SobelKernelY().apply(bluringImage);
 
     if (derivativeX.n_rows != derivativeY.n_rows || derivativeX.n_cols != derivativeY.n_cols)
         throw std::logic_error("non correct size image after unary_map function call");
 
-    Matrix<double> gradLength(src_image.n_rows, src_image.n_cols), gradDirection(src_image.n_rows, src_image.n_cols);
-    for (size_t row = 0; row < derivativeX.n_rows; ++row) {
-        for (size_t col = 0; col < derivativeX.n_cols; ++col) {
-            auto dx = std::get<0>(derivativeX(row, col));
-            auto dy = std::get<0>(derivativeY(row, col));
-            gradLength(row, col) = sqrt(dx * dx + dy * dy);
-            gradDirection(row, col) = atan2(dy, dx);
-        }
-    }
+    Matrix<double> gradLength = binary_map([] (const PixelT& x, const PixelT& y) {
+        auto dx = channelValue(x);
+        auto dy = channelValue(y);
+        return sqrt(dx * dx + dy * dy);
+    }, derivativeX, derivativeY);
+
+    Matrix<double> gradDirection = binary_map([] (const PixelT& x, const PixelT& y) {
+        return atan2(channelValue(y), channelValue(x));
+    }, derivativeX, derivativeY);
 
     Matrix<int> mp(src_image.n_rows, src_image.n_cols);
 
     for (size_t row = 0; row < src_image.n_rows; ++row) {
+        const double* rowLength = gradLength.row_ptr(row);
+        int* rowMp = mp.row_ptr(row);
         for (size_t col = 0; col < src_image.n_cols; ++col) {
             if (isNoMax(gradLength, gradDirection, row, col)) {
-                mp(row, col) = 0;
+                rowMp[col] = 0;
             } else {
-                if (gradLength(row, col) < threshold1)
-                    mp(row, col) = 0;
-                else if (gradLength(row, col) >= threshold1 && gradLength(row, col) <= threshold2)
-                    mp(row, col) = 1;
+                if (rowLength[col] < threshold1)
+                    rowMp[col] = 0;
+                else if (rowLength[col] >= threshold1 && rowLength[col] <= threshold2)
+                    rowMp[col] = 1;
                 else
-                    mp(row, col) = 2;
+                    rowMp[col] = 2;
             }
         }
     }
 
     std::queue<std::pair<size_t, size_t>> q;
     for (size_t row = 0; row < src_image.n_rows; ++row) {
+        const int* rowMp = mp.row_ptr(row);
         for (size_t col = 0; col < src_image.n_cols; ++col) {
-            if (mp(row, col) == 2)
+            if (rowMp[col] == 2)
                 q.push({row, col});
         }
     }
 
     bfs(q, mp);
 
-    Image borderImage(src_image.n_rows, src_image.n_cols);
+    BitMask borderMask(src_image.n_rows, src_image.n_cols);
     for (size_t row = 0; row < src_image.n_rows; ++row) {
+        const int* rowMp = mp.row_ptr(row);
+        uint64_t* rowBorder = borderMask.row_words(row);
         for (size_t col = 0; col < src_image.n_cols; ++col) {
-            if (mp(row, col) == 2)
-                borderImage(row, col) = std::make_tuple(255, 255, 255);
-            else
-                borderImage(row, col) = std::make_tuple(0, 0, 0);
+            if (rowMp[col] == 2)
+                rowBorder[col / BitMask::bitsPerWord] |= uint64_t(1) << (col % BitMask::bitsPerWord);
         }
     }
 
-    return borderImage;
+    return borderMask;
 }
+
+template Image resize(const Image&, double);
+template Plane8 resize(const Plane8&, double);
+template Plane16 resize(const Plane16&, double);
+
+template Image bicubicResize(const Image&, double);
+template Plane8 bicubicResize(const Plane8&, double);
+template Plane16 bicubicResize(const Plane16&, double);
+
+template BitMask canny(const Image&, int, int);
+template BitMask canny(const Plane8&, int, int);
@@ -1,11 +1,18 @@
 #include "align_help.h"
+#include "fft.h"
+#include "row_kernels.h"
 
 #include <stdexcept>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <complex>
+#include <limits>
 
-Image cropImage(const Image& src_image, int threshold1, int threshold2, size_t countRows, size_t countColumns, size_t cntNullable) {
-    auto cannyImage = canny(src_image, threshold1, threshold2);
+template <typename PixelT>
+Matrix<PixelT> cropImage(const Matrix<PixelT>& src_image, int threshold1, int threshold2, size_t countRows, size_t countColumns, size_t cntNullable) {
+    auto edges = canny(src_image, threshold1, threshold2);
 
     struct BorderInfo {
         size_t line;    // start row or column
@@ -30,22 +37,10 @@ Image cropImage(const Image& src_image, int threshold1, int threshold2, size_t c
         std::vector<size_t> values;
 
         for (size_t line = cur.line; cntLines < wd; line += cur.dl, ++cntLines) {
-            size_t row, col;
-            size_t drow = 0, dcol = 0;
-            if (cur.type == BorderInfo::ROW) {
-                row = line;
-                col = 0;
-                dcol = 1;
-            } else {
-                col = line;
-                row = 0;
-                drow = 1;
-            }
+            size_t lines = cur.type == BorderInfo::ROW ? src_image.n_rows : src_image.n_cols;
             size_t cntOnBorder = 0;
-            for (; row < src_image.n_rows && col < src_image.n_cols; row += drow, col += dcol) {
-                if (std::get<0>(cannyImage(row, col)) != 0)
-                    ++cntOnBorder;
-            }
+            if (line < lines)
+                cntOnBorder = cur.type == BorderInfo::ROW ? edges.countRow(line) : edges.countColumn(line);
             values.push_back(cntOnBorder);
         }
 
@@ -70,25 +65,14 @@ Image cropImage(const Image& src_image, int threshold1, int threshold2, size_t c
         }
     }
 
-    return src_image.submatrix(up, left, down - up + 1, right - left + 1).deep_copy();
-}
-
-std::vector<Image> divideImageOnChannels(const Image &image) {
-    std::vector<Image> images;
-    size_t current_row = 0;
-    for (int i = 0; i < 3; ++i) {
-        size_t current_height = (image.n_rows - current_row) / (3 - i);
-        images.push_back(image.submatrix(current_row, 0, current_height, image.n_cols));
-        current_row += current_height;
-    }
-    return images;
+    return src_image.submatrix(up, left, down - up + 1, right - left + 1).materialize();
 }
 
-
-std::vector<Image> getImagesPyramid(const Image& srcImage, double k, size_t minLen, bool isInterp) {
-    std::vector<Image> pyramid;
-    pyramid.push_back(srcImage.deep_copy());
-    Image curImage = isInterp ? bicubicResize(srcImage, k) : resize(srcImage, k);
+template <typename PixelT>
+std::vector<Matrix<PixelT>> getImagesPyramid(const Matrix<PixelT>& srcImage, double k, size_t minLen, bool isInterp) {
+    std::vector<Matrix<PixelT>> pyramid;
+    pyramid.push_back(srcImage);
+    Matrix<PixelT> curImage = isInterp ? bicubicResize(srcImage, k) : resize(srcImage, k);
     while (std::min(curImage.n_rows, curImage.n_cols) >= minLen) {
         pyramid.push_back(curImage);
         curImage = isInterp ? bicubicResize(curImage, k) : resize(curImage, k);
@@ -96,10 +80,37 @@ std::vector<Image> getImagesPyramid(const Image& srcImage, double k, size_t minL
     return pyramid;
 }
 
-Image simpleCropImage(const Image& im, double rowsDiscared, double colsDiscared) {
+template <typename PixelT>
+Matrix<PixelT> simpleCropImage(const Matrix<PixelT>& im, double rowsDiscared, double colsDiscared) {
     size_t drows = round(im.n_rows * rowsDiscared);
     size_t dcols = round(im.n_cols * colsDiscared);
-    return im.submatrix(drows, dcols, im.n_rows - 2 * drows, im.n_cols - 2 * dcols).deep_copy();
+    return im.submatrix(drows, dcols, im.n_rows - 2 * drows, im.n_cols - 2 * dcols).materialize();
+}
+
+// Rows of thirds of plate as in divideImageOnChannels.
+static void splitPlateRows(size_t plateRows, size_t* firstRows, size_t* heights) {
+    for (size_t i = 0, row = 0; i < 3; ++i) {
+        firstRows[i] = row;
+        heights[i] = (plateRows - row) / (3 - i);
+        row += heights[i];
+    }
+}
+
+std::vector<Plane8> loadPlateChannels(const char* path) {
+    ImageInfo info = probe_image(path);
+    if (info.format != ImageFormat::BMP)
+        throw std::string("plate isn't BMP file");
+    // file is decoded by EasyBMP once, not by every part.
+    if (!info.partialReads)
+        return divideImageOnChannels(load_plane(path).materialize());
+    std::vector<Plane8> channels(3);
+    size_t firstRows[3], heights[3];
+    splitPlateRows(info.n_rows, firstRows, heights);
+    ThreadPool::global().parallelFor(0, 3, 1, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            channels[i] = load_plane_roi(path, firstRows[i], 0, heights[i], info.n_cols);
+    });
+    return channels;
 }
 
 CrossImageResult crossImagesImpl(const std::pair<size_t, size_t>& baseImage,
@@ -132,32 +143,54 @@ CrossImageResult crossImagesImpl(const std::pair<size_t, size_t>& baseImage,
 
     return res;
 }
-CrossImageResult crossImages(const Image& image1, const Image& image2, int rowShift, int colShift) {
-    return crossImagesImpl({image1.n_rows, image1.n_cols}, {{image2.n_rows, image2.n_cols}}, {{rowShift, colShift}});
+// Generic row sums for pixels without SIMD kernels (like tuples of Image),
+// planes of 8-bit and 16-bit samples use overloads from row_kernels.h.
+template <typename PixelT>
+static uint64_t rowSquaredDiff(const PixelT* row1, const PixelT* row2, size_t count) {
+    uint64_t res = 0;
+    for (size_t i = 0; i < count; ++i) {
+        long long d = static_cast<long long>(channelValue(row1[i])) - static_cast<long long>(channelValue(row2[i]));
+        res += d * d;
+    }
+    return res;
+}
+
+template <typename PixelT>
+static uint64_t rowDot(const PixelT* row1, const PixelT* row2, size_t count) {
+    uint64_t res = 0;
+    for (size_t i = 0; i < count; ++i)
+        res += static_cast<uint64_t>(channelValue(row1[i])) * channelValue(row2[i]);
+    return res;
 }
 
-CrossImageResult crossImages(const Image& image1, const Image& image2, const Image& image3,
-                             int rowShift2, int colShift2, int rowShift3, int colShift3) {
-    return crossImagesImpl({size_t(image1.n_rows), size_t(image1.n_cols)},
-                           {{size_t(image2.n_rows), size_t(image2.n_cols)}, {size_t(image3.n_rows), size_t(image3.n_cols)}},
-                           {{rowShift2, colShift2}, {rowShift3, colShift3}});
+// Same as calculateSum, but whole rows of cross are summed by rowFunc(row1, row2, width).
+template <typename PixelT, typename RowFunc>
+static unsigned long long calculateRowSum(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, const CrossImageResult& cross,
+                                          int rowShift, int colShift, RowFunc rowFunc) {
+    unsigned long long res = 0;
+    for (size_t r1 = cross.up, r2 = r1 - rowShift; r1 < cross.up + cross.height; ++r1, ++r2)
+        res += rowFunc(image1.row_ptr(r1) + cross.left, image2.row_ptr(r2) + (cross.left - colShift), cross.width);
+    return res;
 }
 
-long double calculateMSE(const Image& image1, const Image& image2, int rowShift, int colShift) {
-    auto cross = crossImages(image1, image2, rowShift, colShift);   // TODO calculate cross one time
-    return static_cast<long double>(calculateSum(image1, image2, rowShift, colShift, [](size_t val1, size_t val2) {
-        int d = static_cast<int>(val1) - static_cast<int>(val2);
-        return d * d;
+template <typename PixelT>
+long double calculateMSE(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, int rowShift, int colShift) {
+    auto cross = crossImages(image1, image2, rowShift, colShift);
+    return static_cast<long double>(calculateRowSum(image1, image2, cross, rowShift, colShift, [](const PixelT* row1, const PixelT* row2, size_t count) {
+        return rowSquaredDiff(row1, row2, count);
     })) / (cross.height * cross.width);
 }
 
-unsigned long long calculateCrossCorrelation(const Image& image1, const Image& image2, int rowShift, int colShift) {
-    return calculateSum(image1, image2, rowShift, colShift, [](size_t val1, size_t val2) {
-        return val1 * val2;
+template <typename PixelT>
+unsigned long long calculateCrossCorrelation(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2, int rowShift, int colShift) {
+    return calculateRowSum(image1, image2, crossImages(image1, image2, rowShift, colShift), rowShift, colShift,
+            [](const PixelT* row1, const PixelT* row2, size_t count) {
+        return rowDot(row1, row2, count);
     });
 }
 
-std::pair<int, int> getBestShiftByMSE(const Image& image1, const Image& image2,
+template <typename PixelT>
+std::pair<int, int> getBestShiftByMSE(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
         int minRowShift, int maxRowShift, int minColShift, int maxColShift)
 {
     return getBestShiftImpl(minRowShift, maxRowShift, minColShift, maxColShift, [&image1, &image2](int dRow, int dCol) {
@@ -165,7 +198,77 @@ std::pair<int, int> getBestShiftByMSE(const Image& image1, const Image& image2,
     }, ActionType::MINIMIZE);
 }
 
-std::pair<int, int> getBestShiftByCrossCorrelation(const Image& image1, const Image& image2,
+template <typename PixelT>
+std::pair<int, int> getBestShiftByBoundedMSE(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
+        int minRowShift, int maxRowShift, int minColShift, int maxColShift)
+{
+    // partial sums are compared with the bound after that many rows.
+    static const size_t boundCheckRows = 8;
+
+    struct Candidate {
+        int dRow, dCol;
+        size_t ring, index;
+    };
+    struct Best {
+        long double value;
+        size_t index;
+    };
+
+    if (maxRowShift < minRowShift || maxColShift < minColShift)
+        return {minRowShift, minColShift};
+    const int centerRow = minRowShift + (maxRowShift - minRowShift) / 2;
+    const int centerCol = minColShift + (maxColShift - minColShift) / 2;
+    const size_t colShifts = maxColShift - minColShift + 1;
+    std::vector<Candidate> candidates;
+    for (int dRow = minRowShift; dRow <= maxRowShift; ++dRow) {
+        for (int dCol = minColShift; dCol <= maxColShift; ++dCol) {
+            const size_t ring = std::max(std::abs(dRow - centerRow), std::abs(dCol - centerCol));
+            const Candidate candidate = {dRow, dCol, ring, candidates.size()};
+            candidates.push_back(candidate);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [] (const Candidate& lhs, const Candidate& rhs) {
+        return lhs.ring < rhs.ring;
+    });
+
+    // best is changed under mutex, bound is its copy for lock-free reads.
+    // It is rounded up to double, so it is never below best value, and a
+    // stale bound only prunes less.
+    Best best = {std::numeric_limits<long double>::infinity(), candidates.size()};
+    std::mutex mutex;
+    std::atomic<double> bound(std::numeric_limits<double>::infinity());
+    auto evaluate = [&] (const Candidate& candidate) {
+        auto cross = crossImages(image1, image2, candidate.dRow, candidate.dCol);
+        const long double area = static_cast<long double>(cross.height) * cross.width;
+        unsigned long long sum = 0;
+        for (size_t r1 = cross.up, r2 = r1 - candidate.dRow; r1 < cross.up + cross.height; ++r1, ++r2) {
+            sum += rowSquaredDiff(image1.row_ptr(r1) + cross.left, image2.row_ptr(r2) + (cross.left - candidate.dCol), cross.width);
+            // full sum is not less than partial one, so the shift can't win or tie.
+            if ((r1 - cross.up) % boundCheckRows == boundCheckRows - 1 && sum / area > bound.load(std::memory_order_relaxed))
+                return;
+        }
+        const long double value = sum / area;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (value < best.value || (!(best.value < value) && candidate.index < best.index)) {
+            best = {value, candidate.index};
+            double rounded = static_cast<double>(value);
+            if (rounded < value)
+                rounded = std::nextafter(rounded, std::numeric_limits<double>::infinity());
+            bound.store(rounded, std::memory_order_relaxed);
+        }
+    };
+
+    // center gives the first bound, rest of shifts are checked in parallel.
+    evaluate(candidates.front());
+    ThreadPool::global().parallelFor(1, candidates.size(), 1, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            evaluate(candidates[i]);
+    });
+    return {minRowShift + static_cast<int>(best.index / colShifts), minColShift + static_cast<int>(best.index % colShifts)};
+}
+
+template <typename PixelT>
+std::pair<int, int> getBestShiftByCrossCorrelation(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
         int minRowShift, int maxRowShift, int minColShift, int maxColShift)
 {
     return getBestShiftImpl(minRowShift, maxRowShift, minColShift, maxColShift, [&image1, &image2](int dRow, int dCol) {
@@ -173,25 +276,312 @@ std::pair<int, int> getBestShiftByCrossCorrelation(const Image& image1, const Im
     }, ActionType::MAXIMIZE);
 }
 
-// GBR
-Image mergeImages(const Image& imageBase, const Image& image1, const Image& image2,
-                  const std::pair<int, int>& shif1, const std::pair<int, int>& shift2)
+// Spectrum of image placed in top left corner of rows x cols zero array.
+// Mean is subtracted and Hann window is applied, so borders of image
+// don't dominate the spectrum.
+template <typename PixelT>
+static std::vector<std::complex<double>> windowedSpectrum(const Matrix<PixelT>& image, size_t rows, size_t cols) {
+    auto hann = [] (size_t n) {
+        std::vector<double> res(n, 1.0);
+        for (size_t i = 0; n > 1 && i < n; ++i)
+            res[i] = 0.5 - 0.5 * cos(2 * M_PI * i / (n - 1));
+        return res;
+    };
+    const std::vector<double> rowWindow = hann(image.n_rows), colWindow = hann(image.n_cols);
+
+    double mean = 0;
+    for (size_t row = 0; row < image.n_rows; ++row) {
+        const PixelT* src = image.row_ptr(row);
+        for (size_t col = 0; col < image.n_cols; ++col)
+            mean += channelValue(src[col]);
+    }
+    mean /= std::max<size_t>(image.n_rows * image.n_cols, 1);
+
+    std::vector<std::complex<double>> res(rows * cols);
+    for (size_t row = 0; row < image.n_rows; ++row) {
+        const PixelT* src = image.row_ptr(row);
+        for (size_t col = 0; col < image.n_cols; ++col)
+            res[row * cols + col] = (channelValue(src[col]) - mean) * rowWindow[row] * colWindow[col];
+    }
+    fft2d(res, rows, cols);
+    return res;
+}
+
+template <typename PixelT>
+std::pair<int, int> getBestShiftByPhaseCorrelation(const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
+        int minRowShift, int maxRowShift, int minColShift, int maxColShift)
+{
+    // padding by the largest shift keeps shifts of window from aliasing.
+    const size_t rows = std::max(image1.n_rows, image2.n_rows) + std::max(std::abs(minRowShift), std::abs(maxRowShift));
+    const size_t cols = std::max(image1.n_cols, image2.n_cols) + std::max(std::abs(minColShift), std::abs(maxColShift));
+
+    auto correlation = windowedSpectrum(image1, rows, cols);
+    const auto spectrum2 = windowedSpectrum(image2, rows, cols);
+    for (size_t i = 0; i < correlation.size(); ++i) {
+        std::complex<double> cross = correlation[i] * std::conj(spectrum2[i]);
+        double len = std::abs(cross);
+        correlation[i] = len > 1e-12 ? cross / len : 0;
+    }
+    fft2d(correlation, rows, cols, true);
+
+    // shift (dRow, dCol) is at (dRow mod rows, dCol mod cols).
+    return getBestShiftImpl(minRowShift, maxRowShift, minColShift, maxColShift, [&](int dRow, int dCol) {
+        const size_t row = (dRow % static_cast<int>(rows) + rows) % rows;
+        const size_t col = (dCol % static_cast<int>(cols) + cols) % cols;
+        return correlation[row * cols + col].real();
+    }, ActionType::MAXIMIZE);
+}
+
+// Walks over cross of three shifted images by rows: storeRow(resRow) gives
+// store(resCol, baseValue, value1, value2), which is called for every pixel
+// of that row. Rows of results are taken once per row, not per pixel.
+template <typename PixelT, typename StoreRowFunc>
+static void mergeImagesImpl(const Matrix<PixelT>& imageBase, const Matrix<PixelT>& image1, const Matrix<PixelT>& image2,
+                            const std::pair<int, int>& shif1, const std::pair<int, int>& shift2,
+                            const CrossImageResult& cross, StoreRowFunc storeRow)
 {
-    auto cross = crossImages(imageBase, image1, image2, shif1.first, shif1.second, shift2.first, shift2.second);
-    Image ans(cross.height, cross.width);
     for (size_t r = cross.up, r1 = r - shif1.first, r2 = r - shift2.first;
          r < imageBase.n_rows && r1 < image1.n_rows && r2 < image2.n_rows;
          ++r, ++r1, ++r2)
     {
+        const PixelT* rowBase = imageBase.row_ptr(r);
+        const PixelT* row1 = image1.row_ptr(r1);
+        const PixelT* row2 = image2.row_ptr(r2);
+        auto store = storeRow(r - cross.up);
         for (size_t c = cross.left, c1 = c - shif1.second, c2 = c - shift2.second;
              c < imageBase.n_cols && c1 < image1.n_cols && c2 < image2.n_cols;
              ++c, ++c1, ++c2)
         {
-            std::get<0>(ans(r - cross.up, c - cross.left)) = std::get<0>(image2(r2, c2));
-            std::get<1>(ans(r - cross.up, c - cross.left)) = std::get<0>(imageBase(r, c));
-            std::get<2>(ans(r - cross.up, c - cross.left)) = std::get<0>(image1(r1, c1));
+            store(c - cross.left, channelValue(rowBase[c]), channelValue(row1[c1]), channelValue(row2[c2]));
         }
     }
+}
+
+// GBR
+Image mergeImages(const Image& imageBase, const Image& image1, const Image& image2,
+                  const std::pair<int, int>& shif1, const std::pair<int, int>& shift2)
+{
+    auto cross = crossImages(imageBase, image1, image2, shif1.first, shif1.second, shift2.first, shift2.second);
+    Image ans(cross.height, cross.width);
+    mergeImagesImpl(imageBase, image1, image2, shif1, shift2, cross, [&ans] (size_t row) {
+        auto* dst = ans.row_ptr(row);
+        return [dst] (size_t col, uint base, uint val1, uint val2) {
+            dst[col] = std::make_tuple(val2, base, val1);
+        };
+    });
     return ans;
 }
 
+template <typename ChannelT>
+PlanarImage<ChannelT> mergeImages(const Matrix<ChannelT>& imageBase, const Matrix<ChannelT>& image1, const Matrix<ChannelT>& image2,
+                                  const std::pair<int, int>& shif1, const std::pair<int, int>& shift2)
+{
+    auto cross = crossImages(imageBase, image1, image2, shif1.first, shif1.second, shift2.first, shift2.second);
+    PlanarImage<ChannelT> ans(cross.height, cross.width);
+    mergeImagesImpl(imageBase, image1, image2, shif1, shift2, cross, [&ans] (size_t row) {
+        ChannelT* red = ans.red.row_ptr(row);
+        ChannelT* green = ans.green.row_ptr(row);
+        ChannelT* blue = ans.blue.row_ptr(row);
+        return [red, green, blue] (size_t col, uint base, uint val1, uint val2) {
+            red[col] = val2;
+            green[col] = base;
+            blue[col] = val1;
+        };
+    });
+    return ans;
+}
+
+namespace {
+
+// Pyramid level of cropped channel of plate in file: pixel (row, col) is
+// source pixel (firstRow + step * row, firstCol + step * col). Resize with
+// scale 0.5 takes every second pixel exactly, so that are pixels of level
+// of in-memory pyramid. Small levels are held in memory (data).
+struct PlateLevel {
+    PlateLevel(const BmpReader* reader_, size_t firstRow_, size_t firstCol_, size_t step_, size_t rows_, size_t cols_)
+        : reader(reader_), firstRow(firstRow_), firstCol(firstCol_), step(step_), n_rows(rows_), n_cols(cols_), data() {}
+    PlateLevel(const PlateLevel&) = default;
+    PlateLevel& operator = (const PlateLevel&) = default;
+
+    const BmpReader* reader;
+    size_t firstRow, firstCol, step;
+    size_t n_rows, n_cols;
+    Plane8 data;
+
+    bool inMemory() const {
+        return data.n_rows != 0;
+    }
+
+    // Rows [row, row + count) of level.
+    Plane8 readRows(size_t row, size_t count) const {
+        if (inMemory())
+            return data.submatrix(row, 0, count, n_cols);
+        if (step == 1)
+            return reader->read_rows(firstRow + row, count).submatrix(0, firstCol, count, n_cols);
+        Plane8 res(count, n_cols);
+        for (size_t i = 0; i < count; ++i) {
+            Plane8 src = reader->read_rows(firstRow + step * (row + i), 1);
+            const uint8_t* srcRow = src.row_ptr(0) + firstCol;
+            uint8_t* dst = res.row_ptr(i);
+            for (size_t col = 0; col < n_cols; ++col)
+                dst[col] = srcRow[step * col];
+        }
+        return res;
+    }
+};
+
+// Same as getBestShiftByMSE, but levels, which are not in memory, are
+// read by bands of bandRows rows and sums of all shifts are accumulated
+// band by band.
+std::pair<int, int> getBestShiftByStreamedMSE(const PlateLevel& level1, const PlateLevel& level2,
+        int minRowShift, int maxRowShift, int minColShift, int maxColShift, size_t bandRows)
+{
+    if (level1.inMemory() && level2.inMemory())
+        return getBestShiftByBoundedMSE(level1.data, level2.data, minRowShift, maxRowShift, minColShift, maxColShift);
+
+    const int colShifts = maxColShift - minColShift + 1;
+    std::vector<CrossImageResult> crosses;
+    for (int dRow = minRowShift; dRow <= maxRowShift; ++dRow) {
+        for (int dCol = minColShift; dCol <= maxColShift; ++dCol)
+            crosses.push_back(crossImagesImpl({level1.n_rows, level1.n_cols}, {{level2.n_rows, level2.n_cols}}, {{dRow, dCol}}));
+    }
+    std::vector<unsigned long long> sums(crosses.size(), 0);
+
+    for (size_t begin = 0; begin < level1.n_rows; begin += bandRows) {
+        const size_t end = std::min(begin + bandRows, level1.n_rows);
+        // rows of second level, which meet the band for some shift.
+        const long long first2 = std::max(0LL, static_cast<long long>(begin) - maxRowShift);
+        const long long end2 = std::min(static_cast<long long>(level2.n_rows), static_cast<long long>(end) - minRowShift);
+        if (first2 >= end2)
+            continue;
+        const Plane8 band1 = level1.readRows(begin, end - begin);
+        const Plane8 band2 = level2.readRows(first2, end2 - first2);
+
+        ThreadPool::global().parallelFor(0, crosses.size(), 1, [&] (size_t firstShift, size_t lastShift) {
+            for (size_t idx = firstShift; idx < lastShift; ++idx) {
+                const int dRow = minRowShift + static_cast<int>(idx) / colShifts;
+                const int dCol = minColShift + static_cast<int>(idx) % colShifts;
+                const CrossImageResult& cross = crosses[idx];
+                unsigned long long sum = 0;
+                for (size_t r1 = std::max(begin, cross.up); r1 < std::min(end, cross.up + cross.height); ++r1) {
+                    const uint8_t* row1 = band1.row_ptr(r1 - begin) + cross.left;
+                    const uint8_t* row2 = band2.row_ptr(r1 - dRow - first2) + (cross.left - dCol);
+                    sum += rowSquaredDiff(row1, row2, cross.width);
+                }
+                sums[idx] += sum;
+            }
+        });
+    }
+
+    return getBestShiftImpl(minRowShift, maxRowShift, minColShift, maxColShift, [&](int dRow, int dCol) {
+        const size_t idx = (dRow - minRowShift) * colShifts + (dCol - minColShift);
+        return static_cast<long double>(sums[idx]) / (crosses[idx].height * crosses[idx].width);
+    }, ActionType::MINIMIZE);
+}
+
+}
+
+PlateShifts alignPlateStreaming(const char* srcPath, const char* dstPath, size_t bandPixels)
+{
+    // Parameters of Model::align for big plates.
+    static const double pyramidScale = 0.5;
+    static const size_t minLen = 300;
+    static const int maxShift = 30;
+
+    if (is_tiff_path(dstPath))
+        throw std::string("streamed result can't be written to TIFF file ") + std::string(dstPath);
+    BmpReader reader(srcPath);
+    const size_t cols = reader.n_cols();
+    const size_t bandRows = std::max<size_t>(bandPixels / std::max<size_t>(cols, 1), 1);
+
+    size_t firstRows[3], heights[3];
+    splitPlateRows(reader.n_rows(), firstRows, heights);
+
+    // pyramids of channels cropped as in simpleCropImage.
+    std::vector<PlateLevel> pyramids[3];
+    for (size_t i = 0; i < 3; ++i) {
+        size_t drows = round(heights[i] * 0.04);
+        size_t dcols = round(cols * 0.05);
+        PlateLevel level(&reader, firstRows[i] + drows, dcols, 1, heights[i] - 2 * drows, cols - 2 * dcols);
+        pyramids[i].push_back(level);
+        while (true) {
+            level.step *= 2;
+            level.n_rows /= 2;
+            level.n_cols /= 2;
+            if (std::min(level.n_rows, level.n_cols) < minLen)
+                break;
+            pyramids[i].push_back(level);
+        }
+
+        // first level that fits is read from file, coarser are resized from it.
+        auto it = std::find_if(pyramids[i].begin(), pyramids[i].end(), [bandPixels] (const PlateLevel& cur) {
+            return cur.n_rows * cur.n_cols <= bandPixels;
+        });
+        if (it != pyramids[i].end()) {
+            auto small = getImagesPyramid(it->readRows(0, it->n_rows), pyramidScale, minLen, false);
+            for (size_t j = 0; j < small.size() && it + j != pyramids[i].end(); ++j)
+                it[j].data = small[j];
+        }
+    }
+
+    auto getBestShift = [bandRows] (const PlateLevel& level1, const PlateLevel& level2,
+                                    int minRowShift, int maxRowShift, int minColShift, int maxColShift) {
+        return getBestShiftByStreamedMSE(level1, level2, minRowShift, maxRowShift, minColShift, maxColShift, bandRows);
+    };
+    const PlateShifts res = {
+        getBestShiftForPyramids(pyramids[1], pyramids[0], getBestShift, maxShift, 2, pyramidScale),
+        getBestShiftForPyramids(pyramids[1], pyramids[2], getBestShift, maxShift, 2, pyramidScale)
+    };
+
+    // merge of uncropped channels, band by band.
+    auto cross = crossImagesImpl({heights[1], cols}, {{heights[0], cols}, {heights[2], cols}},
+                                 {res.shift0, res.shift2});
+    BmpWriter writer(dstPath, cross.height, cross.width);
+    for (size_t row = 0; row < cross.height; row += bandRows) {
+        const size_t count = std::min(bandRows, cross.height - row);
+        const size_t baseRow = cross.up + row;
+        Plane8 base = reader.read_rows(firstRows[1] + baseRow, count);
+        Plane8 band0 = reader.read_rows(firstRows[0] + baseRow - res.shift0.first, count);
+        Plane8 band2 = reader.read_rows(firstRows[2] + baseRow - res.shift2.first, count);
+        writer.write_rows(row, mergeImages(base, band0, band2, {0, res.shift0.second}, {0, res.shift2.second}));
+    }
+    return res;
+}
+
+template Image cropImage(const Image&, int, int, size_t, size_t, size_t);
+template Plane8 cropImage(const Plane8&, int, int, size_t, size_t, size_t);
+
+template Image simpleCropImage(const Image&, double, double);
+template Plane8 simpleCropImage(const Plane8&, double, double);
+template Plane16 simpleCropImage(const Plane16&, double, double);
+
+template std::vector<Image> getImagesPyramid(const Image&, double, size_t, bool);
+template std::vector<Plane8> getImagesPyramid(const Plane8&, double, size_t, bool);
+template std::vector<Plane16> getImagesPyramid(const Plane16&, double, size_t, bool);
+
+template long double calculateMSE(const Image&, const Image&, int, int);
+template long double calculateMSE(const Plane8&, const Plane8&, int, int);
+template long double calculateMSE(const Plane16&, const Plane16&, int, int);
+
+template unsigned long long calculateCrossCorrelation(const Image&, const Image&, int, int);
+template unsigned long long calculateCrossCorrelation(const Plane8&, const Plane8&, int, int);
+template unsigned long long calculateCrossCorrelation(const Plane16&, const Plane16&, int, int);
+
+template std::pair<int, int> getBestShiftByMSE(const Image&, const Image&, int, int, int, int);
+template std::pair<int, int> getBestShiftByMSE(const Plane8&, const Plane8&, int, int, int, int);
+template std::pair<int, int> getBestShiftByMSE(const Plane16&, const Plane16&, int, int, int, int);
+
+template std::pair<int, int> getBestShiftByBoundedMSE(const Image&, const Image&, int, int, int, int);
+template std::pair<int, int> getBestShiftByBoundedMSE(const Plane8&, const Plane8&, int, int, int, int);
+template std::pair<int, int> getBestShiftByBoundedMSE(const Plane16&, const Plane16&, int, int, int, int);
+
+template std::pair<int, int> getBestShiftByCrossCorrelation(const Image&, const Image&, int, int, int, int);
+template std::pair<int, int> getBestShiftByCrossCorrelation(const Plane8&, const Plane8&, int, int, int, int);
+template std::pair<int, int> getBestShiftByCrossCorrelation(const Plane16&, const Plane16&, int, int, int, int);
+
+template std::pair<int, int> getBestShiftByPhaseCorrelation(const Image&, const Image&, int, int, int, int);
+template std::pair<int, int> getBestShiftByPhaseCorrelation(const Plane8&, const Plane8&, int, int, int, int);
+template std::pair<int, int> getBestShiftByPhaseCorrelation(const Plane16&, const Plane16&, int, int, int, int);
+
+template PlanarImage8 mergeImages(const Plane8&, const Plane8&, const Plane8&, const std::pair<int, int>&, const std::pair<int, int>&);
+template PlanarImage16 mergeImages(const Plane16&, const Plane16&, const Plane16&, const std::pair<int, int>&, const std::pair<int, int>&);
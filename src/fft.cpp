@@ -0,0 +1,108 @@
+#include "fft.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+typedef std::complex<double> Complex;
+
+static bool isPowerOfTwo(size_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+static void fftRadix2(Complex* data, size_t n, bool inverse) {
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(data[i], data[j]);
+    }
+
+    // twiddles of the last stage, stage of length len takes every (n / len)-th.
+    std::vector<Complex> twiddles(n / 2);
+    const double angle = (inverse ? 2 : -2) * M_PI / n;
+    for (size_t k = 0; k < n / 2; ++k)
+        twiddles[k] = std::polar(1.0, angle * k);
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        const size_t half = len / 2, step = n / len;
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t j = 0; j < half; ++j) {
+                Complex u = data[i + j];
+                Complex v = data[i + j + half] * twiddles[j * step];
+                data[i + j] = u + v;
+                data[i + j + half] = u - v;
+            }
+        }
+    }
+}
+
+// X(k) = w(k) * sum x(j) w(j) conj(w(k - j)), w(k) = exp(-i pi k^2 / n):
+// convolution of length n computed by radix-2 transforms of length m >= 2n - 1.
+static void fftBluestein(Complex* data, size_t n, bool inverse) {
+    size_t m = 1;
+    while (m < 2 * n - 1)
+        m <<= 1;
+
+    std::vector<Complex> chirp(n);
+    for (size_t k = 0; k < n; ++k) {
+        // k^2 mod 2n keeps angle small and exact.
+        const size_t square = k * k % (2 * n);
+        chirp[k] = std::polar(1.0, (inverse ? 1 : -1) * M_PI * square / n);
+    }
+
+    std::vector<Complex> a(m), b(m);
+    for (size_t k = 0; k < n; ++k)
+        a[k] = data[k] * chirp[k];
+    b[0] = std::conj(chirp[0]);
+    for (size_t k = 1; k < n; ++k)
+        b[k] = b[m - k] = std::conj(chirp[k]);
+
+    fftRadix2(a.data(), m, false);
+    fftRadix2(b.data(), m, false);
+    for (size_t k = 0; k < m; ++k)
+        a[k] *= b[k];
+    fftRadix2(a.data(), m, true);
+
+    for (size_t k = 0; k < n; ++k)
+        data[k] = a[k] * chirp[k] / static_cast<double>(m);
+}
+
+void fft(Complex* data, size_t n, bool inverse) {
+    if (n <= 1)
+        return;
+    if (isPowerOfTwo(n))
+        fftRadix2(data, n, inverse);
+    else
+        fftBluestein(data, n, inverse);
+    if (inverse) {
+        for (size_t k = 0; k < n; ++k)
+            data[k] /= static_cast<double>(n);
+    }
+}
+
+void fft2d(std::vector<Complex>& data, size_t rows, size_t cols, bool inverse) {
+    if (data.size() != rows * cols)
+        throw std::logic_error("size of data doesn't match dimensions");
+    auto& pool = ThreadPool::global();
+
+    pool.parallelFor(0, rows, 1, [&] (size_t begin, size_t end) {
+        for (size_t row = begin; row < end; ++row)
+            fft(data.data() + row * cols, cols, inverse);
+    });
+
+    pool.parallelFor(0, cols, 1, [&] (size_t begin, size_t end) {
+        std::vector<Complex> column(rows);
+        for (size_t col = begin; col < end; ++col) {
+            for (size_t row = 0; row < rows; ++row)
+                column[row] = data[row * cols + col];
+            fft(column.data(), rows, inverse);
+            for (size_t row = 0; row < rows; ++row)
+                data[row * cols + col] = column[row];
+        }
+    });
+}
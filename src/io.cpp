@@ -1,14 +1,363 @@
 #include "io.h"
+#include "thread_pool.h"
+#include "buffer_pool.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using std::string;
 
 using std::tuple;
 using std::make_tuple;
 using std::tie;
 
+namespace {
+
+// Whole file mapped to memory. Pages are private and writable, so
+// matrices over mapped pixels can be written without touching the file.
+std::shared_ptr<uint8_t> mapFile(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    *size = info.st_size;
+    void *data = mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return nullptr;
+    madvise(data, *size, MADV_SEQUENTIAL);
+    size_t length = *size;
+    return std::shared_ptr<uint8_t>(static_cast<uint8_t*>(data), [length] (uint8_t *ptr) {
+        munmap(ptr, length);
+    });
+}
+
+template <typename T>
+T readLE(const uint8_t *ptr)
+{
+    uint64_t res = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+        res |= uint64_t(ptr[i]) << (8 * i);
+    return static_cast<T>(res);
+}
+
+}
+
+// Parsed header of uncompressed BMP file with 8 (palette), 24 or 32 bits
+// per pixel.
+struct BmpReader::Header {
+    Header() : width(0), height(0), topDown(false), bitsPerPixel(0), stride(0), offset(0),
+               palette(), gray(false) {}
+
+    uint width, height;
+    bool topDown;
+    uint bitsPerPixel;
+    size_t stride;
+    // Offset of pixels in file.
+    size_t offset;
+    // rgb of palette entries for 8-bit files.
+    uint8_t palette[256][3];
+    bool gray;
+
+    // Offset of row from pixels start, rows are counted from top of image.
+    size_t rowOffset(uint i) const
+    {
+        return (topDown ? i : height - 1 - i) * stride;
+    }
+
+    // Parse first available bytes of file of size fileSize. Returns false for
+    // files native decoder doesn't support, they are left to EasyBMP.
+    bool parse(const uint8_t *data, size_t available, size_t fileSize);
+
+    // Decode pixels [firstCol, firstCol + cols) of row from src, store(j, r, g, b)
+    // is called for every pixel, j is counted from firstCol.
+    template <typename StoreFunc>
+    void decodeRow(const uint8_t *src, uint firstCol, uint cols, StoreFunc store) const
+    {
+        if (bitsPerPixel == 8) {
+            src += firstCol;
+            for (uint j = 0; j < cols; ++j) {
+                const uint8_t *rgb = palette[src[j]];
+                store(j, rgb[0], rgb[1], rgb[2]);
+            }
+        } else {
+            const uint bytes = bitsPerPixel / 8;
+            src += firstCol * bytes;
+            for (uint j = 0; j < cols; ++j, src += bytes)
+                store(j, src[2], src[1], src[0]);
+        }
+    }
+};
+
+bool BmpReader::Header::parse(const uint8_t *data, size_t available, size_t fileSize)
+{
+    if (available < 54 || data[0] != 'B' || data[1] != 'M')
+        return false;
+
+    uint32_t pixelsOffset = readLE<uint32_t>(data + 10);
+    uint32_t headerSize = readLE<uint32_t>(data + 14);
+    int32_t fileWidth = readLE<int32_t>(data + 18);
+    int32_t fileHeight = readLE<int32_t>(data + 22);
+    uint16_t fileBitsPerPixel = readLE<uint16_t>(data + 28);
+    uint32_t compression = readLE<uint32_t>(data + 30);
+    uint32_t colorsUsed = readLE<uint32_t>(data + 46);
+
+    if (headerSize < 40 || compression != 0 || fileWidth <= 0 || fileHeight == 0)
+        return false;
+    if (fileBitsPerPixel != 8 && fileBitsPerPixel != 24 && fileBitsPerPixel != 32)
+        return false;
+
+    width = fileWidth;
+    height = fileHeight < 0 ? -static_cast<int64_t>(fileHeight) : fileHeight;
+    topDown = fileHeight < 0;
+    bitsPerPixel = fileBitsPerPixel;
+    stride = (static_cast<size_t>(width) * bitsPerPixel + 31) / 32 * 4;
+    offset = pixelsOffset;
+    if (offset > fileSize || stride * height > fileSize - offset)
+        return false;
+
+    gray = false;
+    if (bitsPerPixel == 8) {
+        size_t colors = colorsUsed ? colorsUsed : 256;
+        size_t paletteOffset = 14 + static_cast<size_t>(headerSize);
+        if (colors > 256 || paletteOffset + 4 * colors > std::min(offset, available))
+            return false;
+        gray = colors == 256;
+        for (size_t i = 0; i < colors; ++i) {
+            const uint8_t *entry = data + paletteOffset + 4 * i;
+            palette[i][0] = entry[2];
+            palette[i][1] = entry[1];
+            palette[i][2] = entry[0];
+            gray &= entry[0] == i && entry[1] == i && entry[2] == i;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+// Whole BMP file mapped to memory.
+struct BmpFile : BmpReader::Header {
+    BmpFile() : file(), pixels(nullptr) {}
+    BmpFile(const BmpFile&) = delete;
+    BmpFile& operator = (const BmpFile&) = delete;
+
+    std::shared_ptr<uint8_t> file;
+    const uint8_t *pixels;
+
+    const uint8_t *row(uint i) const
+    {
+        return pixels + rowOffset(i);
+    }
+};
+
+// Map and parse BMP file. Returns false for files native decoder doesn't
+// support (or can't read), they are left to EasyBMP.
+bool openBmp(const char *path, BmpFile *bmp)
+{
+    size_t size = 0;
+    bmp->file = mapFile(path, &size);
+    if (!bmp->file || !bmp->parse(bmp->file.get(), size, size))
+        return false;
+    bmp->pixels = bmp->file.get() + bmp->offset;
+    return true;
+}
+
+// Decode pixels of rectangle with top left corner (row, col), store(i, j, r, g, b)
+// is called for every pixel, i and j are counted from the corner. Only rows
+// of rectangle are touched, they are decoded in parallel.
+template <typename StoreFunc>
+void decodeBmp(const BmpFile &bmp, uint row, uint col, uint rows, uint cols, StoreFunc store)
+{
+    if (row + rows > bmp.height || col + cols > bmp.width)
+        throw string("Out of bounds");
+    const size_t minBand = std::max<size_t>((1 << 16) / std::max<uint>(cols, 1), 1);
+    ThreadPool::global().parallelFor(0, rows, minBand, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            bmp.decodeRow(bmp.row(row + i), col, cols, [&store, i] (uint j, uint8_t r, uint8_t g, uint8_t b) {
+                store(i, j, r, g, b);
+            });
+        }
+    });
+}
+
+// Decode all pixels.
+template <typename StoreFunc>
+void decodeBmp(const BmpFile &bmp, StoreFunc store)
+{
+    decodeBmp(bmp, 0, 0, bmp.height, bmp.width, store);
+}
+
+// One channel of rectangle of image as a plane. For top-down 8-bit
+// grayscale file plane points right into mapped pixel rows.
+Plane8 decodePlane(const BmpFile &bmp, uint row, uint col, uint rows, uint cols, size_t channel)
+{
+    if (channel >= 3)
+        throw string("no such channel");
+    if (bmp.gray && bmp.topDown) {
+        if (row + rows > bmp.height || col + cols > bmp.width)
+            throw string("Out of bounds");
+        // file stays mapped while plane lives.
+        std::shared_ptr<uint8_t> pixels(bmp.file, const_cast<uint8_t*>(bmp.row(row) + col));
+        return Plane8(rows, cols, bmp.stride, pixels);
+    }
+
+    Plane8 res = Plane8::uninitialized(rows, cols);
+    decodeBmp(bmp, row, col, rows, cols, [&res, channel] (size_t i, uint j, uint8_t r, uint8_t g, uint8_t b) {
+        res.row_ptr(i)[j] = channel == 0 ? r : channel == 1 ? g : b;
+    });
+    return res;
+}
+
+template <typename T>
+void writeLE(uint8_t *ptr, T value)
+{
+    for (size_t i = 0; i < sizeof(T); ++i)
+        ptr[i] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+}
+
+size_t bmpStride(uint width, uint bitsPerPixel)
+{
+    return (static_cast<size_t>(width) * bitsPerPixel + 31) / 32 * 4;
+}
+
+size_t bmpHeaderSize(uint bitsPerPixel)
+{
+    return 54 + (bitsPerPixel == 8 ? 256 * 4 : 0);
+}
+
+// Header of uncompressed bottom-up BMP with 8 (gray palette) or 24 bits
+// per pixel, the same as EasyBMP writes. Returns size of whole file.
+size_t formatBmpHeader(uint8_t *data, uint height, uint width, uint bitsPerPixel)
+{
+    const size_t stride = bmpStride(width, bitsPerPixel);
+    const size_t offset = bmpHeaderSize(bitsPerPixel);
+    const size_t size = offset + stride * height;
+
+    std::memset(data, 0, offset);
+    data[0] = 'B';
+    data[1] = 'M';
+    writeLE<uint32_t>(data + 2, size);
+    writeLE<uint32_t>(data + 10, offset);
+    writeLE<uint32_t>(data + 14, 40);
+    writeLE<int32_t>(data + 18, width);
+    writeLE<int32_t>(data + 22, height);
+    writeLE<uint16_t>(data + 26, 1);
+    writeLE<uint16_t>(data + 28, bitsPerPixel);
+    writeLE<uint32_t>(data + 34, stride * height);
+    writeLE<uint32_t>(data + 38, 3780);
+    writeLE<uint32_t>(data + 42, 3780);
+    for (size_t i = 0; i < (offset - 54) / 4; ++i)
+        std::memset(data + 54 + 4 * i, static_cast<int>(i), 3);
+    return size;
+}
+
+// pwrite all size bytes by big chunks.
+bool writeAll(int fd, const uint8_t *data, size_t size, size_t offset)
+{
+    const size_t chunk = 64 << 20;
+    for (size_t done = 0; done < size; ) {
+        ssize_t res = pwrite(fd, data + done, std::min(chunk, size - done), offset + done);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        done += res;
+    }
+    return true;
+}
+
+// pread exactly size bytes.
+bool readAll(int fd, uint8_t *data, size_t size, size_t offset)
+{
+    for (size_t done = 0; done < size; ) {
+        ssize_t res = pread(fd, data + done, size - done, offset + done);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        done += res;
+    }
+    return true;
+}
+
+// Format rows [row, row + count) of planar image as 24-bit BMP rows. Rows
+// of bottom-up file go in reverse order, so the last row is at dst.
+void encodeRows(const PlanarImage8 &im, uint row, uint count, uint8_t *dst)
+{
+    const size_t stride = bmpStride(im.n_cols(), 24);
+    for (uint i = 0; i < count; ++i) {
+        const uint8_t *r = im.red.row_ptr(row + i);
+        const uint8_t *g = im.green.row_ptr(row + i);
+        const uint8_t *b = im.blue.row_ptr(row + i);
+        uint8_t *out = dst + (count - 1 - i) * stride;
+        for (uint j = 0; j < im.n_cols(); ++j, out += 3) {
+            out[0] = b[j];
+            out[1] = g[j];
+            out[2] = r[j];
+        }
+    }
+}
+
+// Write uncompressed bottom-up BMP. encode(row, dst) formats pixels of
+// image row into dst, padding is already zero. Whole file is formatted
+// in memory (rows in parallel) and written by big chunks.
+template <typename EncodeFunc>
+void writeBmp(const char *path, uint height, uint width, uint bitsPerPixel, EncodeFunc encode)
+{
+    const size_t stride = bmpStride(width, bitsPerPixel);
+    const size_t offset = bmpHeaderSize(bitsPerPixel);
+    const size_t size = offset + stride * height;
+
+    std::shared_ptr<uint8_t> file = BufferPool::global().allocate<uint8_t>(size);
+    uint8_t *data = file.get();
+    formatBmpHeader(data, height, width, bitsPerPixel);
+
+    uint8_t *pixels = data + offset;
+    const size_t minBand = std::max<size_t>((1 << 16) / std::max<size_t>(stride, 1), 1);
+    ThreadPool::global().parallelFor(0, height, minBand, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            encode(i, pixels + (height - 1 - i) * stride);
+    });
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw string("Error writing file ") + string(path);
+    bool written = writeAll(fd, data, size, 0);
+    if (close(fd) != 0 || !written)
+        throw string("Error writing file ") + string(path);
+}
+
+}
+
 Image load_image(const char *path)
 {
+    BmpFile bmp;
+    if (openBmp(path, &bmp)) {
+        Image res(bmp.height, bmp.width);
+        decodeBmp(bmp, [&res] (size_t row, uint col, uint8_t r, uint8_t g, uint8_t b) {
+            res.row_ptr(row)[col] = make_tuple(r, g, b);
+        });
+        return res;
+    }
+
     BMP in;
 
     if (!in.ReadFromFile(path))
@@ -28,20 +377,584 @@ Image load_image(const char *path)
 
 void save_image(const Image &im, const char *path)
 {
-    BMP out;
-    out.SetSize(im.n_cols, im.n_rows);
+    writeBmp(path, im.n_rows, im.n_cols, 24, [&im] (size_t row, uint8_t *dst) {
+        const Image::value_type *src = im.row_ptr(row);
+        for (uint j = 0; j < im.n_cols; ++j, dst += 3) {
+            dst[0] = std::get<2>(src[j]);
+            dst[1] = std::get<1>(src[j]);
+            dst[2] = std::get<0>(src[j]);
+        }
+    });
+}
+
+PlanarImage8 load_planar_image(const char *path)
+{
+    BmpFile bmp;
+    if (openBmp(path, &bmp)) {
+        PlanarImage8 res(bmp.height, bmp.width);
+        decodeBmp(bmp, [&res] (size_t row, uint col, uint8_t r, uint8_t g, uint8_t b) {
+            res.red.row_ptr(row)[col] = r;
+            res.green.row_ptr(row)[col] = g;
+            res.blue.row_ptr(row)[col] = b;
+        });
+        return res;
+    }
+
+    BMP in;
+
+    if (!in.ReadFromFile(path))
+        throw string("Error reading file ") + string(path);
 
-    uint r, g, b;
-    RGBApixel p;
-    p.Alpha = 255;
-    for (uint i = 0; i < im.n_rows; ++i) {
-        for (uint j = 0; j < im.n_cols; ++j) {
-            tie(r, g, b) = im(i, j);
-            p.Red = r; p.Green = g; p.Blue = b;
-            out.SetPixel(j, i, p);
+    PlanarImage8 res(in.TellHeight(), in.TellWidth());
+
+    for (uint i = 0; i < res.n_rows(); ++i) {
+        for (uint j = 0; j < res.n_cols(); ++j) {
+            RGBApixel *p = in(j, i);
+            res.red(i, j) = p->Red;
+            res.green(i, j) = p->Green;
+            res.blue(i, j) = p->Blue;
         }
     }
 
-    if (!out.WriteToFile(path))
+    return res;
+}
+
+Plane8 load_plane(const char *path, size_t channel)
+{
+    if (channel >= 3)
+        throw string("no such channel");
+    BmpFile bmp;
+    if (!openBmp(path, &bmp))
+        return load_planar_image(path).plane(channel);
+    return decodePlane(bmp, 0, 0, bmp.height, bmp.width, channel);
+}
+
+Image load_image_roi(const char *path, uint row, uint col, uint rows, uint cols)
+{
+    BmpFile bmp;
+    if (!openBmp(path, &bmp))
+        return load_image(path).submatrix(row, col, rows, cols).materialize();
+    Image res(rows, cols);
+    decodeBmp(bmp, row, col, rows, cols, [&res] (size_t i, uint j, uint8_t r, uint8_t g, uint8_t b) {
+        res.row_ptr(i)[j] = make_tuple(r, g, b);
+    });
+    return res;
+}
+
+Plane8 load_plane_roi(const char *path, uint row, uint col, uint rows, uint cols, size_t channel)
+{
+    if (channel >= 3)
+        throw string("no such channel");
+    BmpFile bmp;
+    if (!openBmp(path, &bmp))
+        return load_planar_image(path).plane(channel).submatrix(row, col, rows, cols).materialize();
+    return decodePlane(bmp, row, col, rows, cols, channel);
+}
+
+void save_image(const PlanarImage8 &im, const char *path)
+{
+    writeBmp(path, im.n_rows(), im.n_cols(), 24, [&im] (size_t row, uint8_t *dst) {
+        encodeRows(im, row, 1, dst);
+    });
+}
+
+void save_plane(const Plane8 &plane, const char *path)
+{
+    writeBmp(path, plane.n_rows, plane.n_cols, 8, [&plane] (size_t row, uint8_t *dst) {
+        std::memcpy(dst, plane.row_ptr(row), plane.n_cols);
+    });
+}
+
+BmpReader::BmpReader(const char *path)
+    : fd(open(path, O_RDONLY)), header(new Header())
+{
+    if (fd < 0)
+        throw string("Error reading file ") + string(path);
+    struct stat info;
+    uint8_t data[54 + 256 * 4 + 256];
+    ssize_t available = 0;
+    if (fstat(fd, &info) == 0)
+        available = pread(fd, data, sizeof(data), 0);
+    if (available <= 0 || !header->parse(data, available, info.st_size)) {
+        close(fd);
+        throw string("Unsupported BMP file ") + string(path);
+    }
+}
+
+BmpReader::~BmpReader()
+{
+    close(fd);
+}
+
+uint BmpReader::n_rows() const
+{
+    return header->height;
+}
+
+uint BmpReader::n_cols() const
+{
+    return header->width;
+}
+
+Plane8 BmpReader::read_rows(uint row, uint count, size_t channel) const
+{
+    if (channel >= 3)
+        throw string("no such channel");
+    if (row + count > header->height)
+        throw string("Out of bounds");
+    if (count == 0)
+        return Plane8(0, header->width);
+
+    // rows of band are contiguous in file, in reverse order for bottom-up file.
+    const size_t stride = header->stride;
+    const uint first = header->topDown ? row : row + count - 1;
+    std::shared_ptr<uint8_t> raw = BufferPool::global().allocate<uint8_t>(count * stride, false);
+    if (!readAll(fd, raw.get(), count * stride, header->offset + header->rowOffset(first)))
+        throw string("Error reading file");
+
+    Plane8 res = Plane8::uninitialized(count, header->width);
+    const size_t minBand = std::max<size_t>((1 << 16) / header->width, 1);
+    ThreadPool::global().parallelFor(0, count, minBand, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const uint8_t *src = raw.get() + (header->topDown ? i : count - 1 - i) * stride;
+            uint8_t *dst = res.row_ptr(i);
+            header->decodeRow(src, 0, header->width, [dst, channel] (uint col, uint8_t r, uint8_t g, uint8_t b) {
+                dst[col] = channel == 0 ? r : channel == 1 ? g : b;
+            });
+        }
+    });
+    return res;
+}
+
+BmpWriter::BmpWriter(const char *path, uint row_count, uint col_count)
+    : fd(open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)), rows(row_count), cols(col_count)
+{
+    uint8_t header[54];
+    size_t size = formatBmpHeader(header, rows, cols, 24);
+    if (fd < 0 || !writeAll(fd, header, sizeof(header), 0) || ftruncate(fd, size) != 0) {
+        if (fd >= 0)
+            close(fd);
+        throw string("Error writing file ") + string(path);
+    }
+}
+
+BmpWriter::~BmpWriter()
+{
+    close(fd);
+}
+
+void BmpWriter::write_rows(uint row, const PlanarImage8 &band)
+{
+    const uint count = band.n_rows();
+    if (band.n_cols() != cols || row + count > rows)
+        throw string("Out of bounds");
+    const size_t stride = bmpStride(cols, 24);
+    std::shared_ptr<uint8_t> data = BufferPool::global().allocate<uint8_t>(count * stride);
+    const size_t minBand = std::max<size_t>((1 << 16) / std::max<size_t>(stride, 1), 1);
+    ThreadPool::global().parallelFor(0, count, minBand, [&] (size_t begin, size_t end) {
+        encodeRows(band, begin, end - begin, data.get() + (count - end) * stride);
+    });
+    if (!writeAll(fd, data.get(), count * stride, bmpHeaderSize(24) + (rows - row - count) * stride))
+        throw string("Error writing file");
+}
+
+namespace {
+
+// Baseline TIFF with 8 or 16 bits per sample, gray or RGB, stored by strips
+// without compression or with PackBits.
+struct TiffFile {
+    TiffFile() : file(), size(0), bigEndian(false), width(0), height(0), bitsPerSample(0),
+                 samplesPerPixel(1), compression(1), photometric(1), planar(1), rowsPerStrip(0),
+                 stripOffsets(), stripByteCounts() {}
+    TiffFile(const TiffFile&) = delete;
+    TiffFile& operator = (const TiffFile&) = delete;
+
+    std::shared_ptr<uint8_t> file;
+    size_t size;
+    bool bigEndian;
+    uint width, height, bitsPerSample, samplesPerPixel;
+    uint compression, photometric, planar, rowsPerStrip;
+    std::vector<uint32_t> stripOffsets, stripByteCounts;
+
+    template <typename T>
+    T read(size_t offset) const
+    {
+        if (offset > size || sizeof(T) > size - offset)
+            throw string("Broken TIFF file");
+        const uint8_t *ptr = file.get() + offset;
+        uint64_t res = 0;
+        for (size_t i = 0; i < sizeof(T); ++i)
+            res |= uint64_t(ptr[i]) << (8 * (bigEndian ? sizeof(T) - 1 - i : i));
+        return static_cast<T>(res);
+    }
+
+    // Values of IFD entry of type BYTE, SHORT or LONG.
+    std::vector<uint32_t> values(size_t entry) const
+    {
+        const uint16_t type = read<uint16_t>(entry + 2);
+        const uint32_t count = read<uint32_t>(entry + 4);
+        const size_t bytes = type == 1 ? 1 : type == 3 ? 2 : type == 4 ? 4 : 0;
+        if (bytes == 0 || count > size)
+            throw string("Unsupported TIFF tag type");
+        size_t offset = count * bytes <= 4 ? entry + 8 : read<uint32_t>(entry + 8);
+        std::vector<uint32_t> res(count);
+        for (uint32_t i = 0; i < count; ++i, offset += bytes)
+            res[i] = bytes == 1 ? read<uint8_t>(offset) : bytes == 2 ? read<uint16_t>(offset) : read<uint32_t>(offset);
+        return res;
+    }
+};
+
+void openTiff(const char *path, TiffFile *tiff)
+{
+    tiff->file = mapFile(path, &tiff->size);
+    if (!tiff->file)
+        throw string("Error reading file ") + string(path);
+    const uint8_t *data = tiff->file.get();
+    if (tiff->size < 8 || !((data[0] == 'I' && data[1] == 'I') || (data[0] == 'M' && data[1] == 'M')))
+        throw string("Not a TIFF file ") + string(path);
+    tiff->bigEndian = data[0] == 'M';
+    if (tiff->read<uint16_t>(2) != 42)
+        throw string("Not a TIFF file ") + string(path);
+
+    const size_t ifd = tiff->read<uint32_t>(4);
+    const uint16_t entries = tiff->read<uint16_t>(ifd);
+    for (size_t i = 0; i < entries; ++i) {
+        const size_t entry = ifd + 2 + 12 * i;
+        switch (tiff->read<uint16_t>(entry)) {
+        case 256: tiff->width = tiff->values(entry).at(0); break;
+        case 257: tiff->height = tiff->values(entry).at(0); break;
+        case 258: tiff->bitsPerSample = tiff->values(entry).at(0); break;
+        case 259: tiff->compression = tiff->values(entry).at(0); break;
+        case 262: tiff->photometric = tiff->values(entry).at(0); break;
+        case 273: tiff->stripOffsets = tiff->values(entry); break;
+        case 277: tiff->samplesPerPixel = tiff->values(entry).at(0); break;
+        case 278: tiff->rowsPerStrip = tiff->values(entry).at(0); break;
+        case 279: tiff->stripByteCounts = tiff->values(entry); break;
+        case 284: tiff->planar = tiff->values(entry).at(0); break;
+        default: break;
+        }
+    }
+
+    if (tiff->width == 0 || tiff->height == 0)
+        throw string("Empty TIFF image ") + string(path);
+    if (tiff->bitsPerSample != 8 && tiff->bitsPerSample != 16)
+        throw string("Unsupported TIFF bits per sample in ") + string(path);
+    if (tiff->compression != 1 && tiff->compression != 32773)
+        throw string("Unsupported TIFF compression in ") + string(path);
+    if (tiff->photometric > 2 || (tiff->photometric == 2) != (tiff->samplesPerPixel >= 3))
+        throw string("Unsupported TIFF color space in ") + string(path);
+    if (tiff->rowsPerStrip == 0 || tiff->rowsPerStrip > tiff->height)
+        tiff->rowsPerStrip = tiff->height;
+    const size_t strips = (tiff->height + tiff->rowsPerStrip - 1) / tiff->rowsPerStrip;
+    const size_t planes = tiff->planar == 2 ? tiff->samplesPerPixel : 1;
+    if (tiff->stripOffsets.size() != strips * planes || tiff->stripByteCounts.size() != strips * planes)
+        throw string("Broken TIFF strips in ") + string(path);
+}
+
+// Unpack PackBits data of src into exactly size bytes of dst.
+void unpackBits(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t size)
+{
+    size_t pos = 0, done = 0;
+    while (done < size) {
+        if (pos >= srcSize)
+            throw string("Broken PackBits data");
+        const int n = static_cast<int8_t>(src[pos++]);
+        if (n >= 0) {
+            const size_t count = n + 1;
+            if (pos + count > srcSize || done + count > size)
+                throw string("Broken PackBits data");
+            std::memcpy(dst + done, src + pos, count);
+            pos += count;
+            done += count;
+        } else if (n != -128) {
+            const size_t count = 1 - n;
+            if (pos >= srcSize || done + count > size)
+                throw string("Broken PackBits data");
+            std::memset(dst + done, src[pos++], count);
+            done += count;
+        }
+    }
+}
+
+// Pack row of bytes with PackBits.
+void packBits(const uint8_t *src, size_t size, std::vector<uint8_t> *dst)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        size_t run = 1;
+        while (pos + run < size && run < 128 && src[pos + run] == src[pos])
+            ++run;
+        if (run >= 2) {
+            dst->push_back(static_cast<uint8_t>(257 - run));
+            dst->push_back(src[pos]);
+            pos += run;
+            continue;
+        }
+        size_t start = pos;
+        while (pos < size && pos - start < 128 && !(pos + 1 < size && src[pos] == src[pos + 1]))
+            ++pos;
+        dst->push_back(static_cast<uint8_t>(pos - start - 1));
+        dst->insert(dst->end(), src + start, src + pos);
+    }
+}
+
+// Decode all samples, store(row, col, sample, value) is called for samples
+// 0..2 of every pixel, WhiteIsZero gray is inverted. Strips are decoded
+// in parallel.
+template <typename StoreFunc>
+void decodeTiff(const TiffFile &tiff, StoreFunc store)
+{
+    const size_t strips = (tiff.height + tiff.rowsPerStrip - 1) / tiff.rowsPerStrip;
+    const size_t samples = tiff.planar == 2 ? 1 : tiff.samplesPerPixel;
+    const size_t bytesPerSample = tiff.bitsPerSample / 8;
+    const size_t rowBytes = static_cast<size_t>(tiff.width) * samples * bytesPerSample;
+    const uint maxValue = tiff.bitsPerSample == 16 ? 65535 : 255;
+
+    ThreadPool::global().parallelFor(0, tiff.stripOffsets.size(), 1, [&] (size_t begin, size_t end) {
+        std::vector<uint8_t> unpacked;
+        for (size_t idx = begin; idx < end; ++idx) {
+            const size_t plane = tiff.planar == 2 ? idx / strips : 0;
+            const size_t firstRow = (idx % strips) * tiff.rowsPerStrip;
+            const size_t rows = std::min<size_t>(tiff.rowsPerStrip, tiff.height - firstRow);
+            if (plane >= 3)
+                continue;
+
+            const size_t offset = tiff.stripOffsets[idx], stored = tiff.stripByteCounts[idx];
+            if (offset > tiff.size || stored > tiff.size - offset)
+                throw string("Broken TIFF strips");
+            const uint8_t *data = tiff.file.get() + offset;
+            if (tiff.compression == 32773) {
+                unpacked.resize(rows * rowBytes);
+                unpackBits(data, stored, unpacked.data(), unpacked.size());
+                data = unpacked.data();
+            } else if (stored < rows * rowBytes) {
+                throw string("Broken TIFF strips");
+            }
+
+            for (size_t i = 0; i < rows; ++i) {
+                const uint8_t *src = data + i * rowBytes;
+                for (uint col = 0; col < tiff.width; ++col) {
+                    for (size_t sample = 0; sample < samples && plane + sample < 3; ++sample, src += bytesPerSample) {
+                        uint value = bytesPerSample == 1 ? src[0] :
+                                     tiff.bigEndian ? (src[0] << 8) | src[1] : (src[1] << 8) | src[0];
+                        if (tiff.photometric == 0)
+                            value = maxValue - value;
+                        store(firstRow + i, col, plane + sample, value);
+                    }
+                    if (samples > 3 - plane)
+                        src += (samples - (3 - plane)) * bytesPerSample;
+                }
+            }
+        }
+    });
+}
+
+// Write little-endian 16-bit TIFF with samples (1 - gray, 3 - RGB) per pixel.
+// encode(row, dst) puts samples of image row to dst. Strips are formatted
+// (and compressed) in parallel.
+template <typename EncodeFunc>
+void writeTiff(const char *path, uint height, uint width, uint samples, bool compress, EncodeFunc encode)
+{
+    const size_t rowBytes = static_cast<size_t>(width) * samples * 2;
+    const size_t rowsPerStrip = std::max<size_t>((1 << 20) / std::max<size_t>(rowBytes, 1), 1);
+    const size_t strips = (height + rowsPerStrip - 1) / rowsPerStrip;
+
+    std::vector<std::vector<uint8_t>> data(strips);
+    ThreadPool::global().parallelFor(0, strips, 1, [&] (size_t begin, size_t end) {
+        std::vector<uint16_t> values(static_cast<size_t>(width) * samples);
+        std::vector<uint8_t> row(rowBytes);
+        for (size_t idx = begin; idx < end; ++idx) {
+            const size_t firstRow = idx * rowsPerStrip;
+            const size_t rows = std::min<size_t>(rowsPerStrip, height - firstRow);
+            if (!compress)
+                data[idx].reserve(rows * rowBytes);
+            for (size_t i = firstRow; i < firstRow + rows; ++i) {
+                encode(i, values.data());
+                for (size_t j = 0; j < values.size(); ++j)
+                    writeLE<uint16_t>(row.data() + 2 * j, values[j]);
+                if (compress)
+                    packBits(row.data(), row.size(), &data[idx]);
+                else
+                    data[idx].insert(data[idx].end(), row.begin(), row.end());
+            }
+        }
+    });
+
+    // header, strips, then IFD with arrays of its entries.
+    std::vector<size_t> offsets(strips);
+    size_t offset = 8;
+    for (size_t idx = 0; idx < strips; ++idx) {
+        offsets[idx] = offset;
+        offset += data[idx].size();
+    }
+    offset += offset % 2;
+    if (offset + 12 * strips + 256 > UINT32_MAX)
+        throw string("Image is too big for TIFF file");
+
+    const size_t ifdOffset = offset;
+    const uint16_t entries = 10;
+    std::vector<uint8_t> ifd(2 + 12 * entries + 4);
+    const size_t arraysOffset = ifdOffset + ifd.size();
+    std::vector<uint8_t> arrays;
+    auto addArray = [&arrays, arraysOffset] (size_t count, size_t bytes, std::function<uint32_t(size_t)> value) {
+        const size_t res = arraysOffset + arrays.size();
+        for (size_t i = 0; i < count; ++i) {
+            arrays.resize(arrays.size() + bytes);
+            if (bytes == 2)
+                writeLE<uint16_t>(arrays.data() + arrays.size() - 2, value(i));
+            else
+                writeLE<uint32_t>(arrays.data() + arrays.size() - 4, value(i));
+        }
+        return res;
+    };
+
+    writeLE<uint16_t>(ifd.data(), entries);
+    size_t entry = 0;
+    auto addEntry = [&ifd, &entry] (uint16_t tag, uint16_t type, uint32_t count, uint32_t value) {
+        uint8_t *ptr = ifd.data() + 2 + 12 * entry++;
+        writeLE<uint16_t>(ptr, tag);
+        writeLE<uint16_t>(ptr + 2, type);
+        writeLE<uint32_t>(ptr + 4, count);
+        if (type == 3 && count == 1)
+            writeLE<uint16_t>(ptr + 8, value);
+        else
+            writeLE<uint32_t>(ptr + 8, value);
+    };
+    addEntry(256, 4, 1, width);
+    addEntry(257, 4, 1, height);
+    if (samples == 1)
+        addEntry(258, 3, 1, 16);
+    else
+        addEntry(258, 3, samples, addArray(samples, 2, [] (size_t) { return 16; }));
+    addEntry(259, 3, 1, compress ? 32773 : 1);
+    addEntry(262, 3, 1, samples == 1 ? 1 : 2);
+    addEntry(273, 4, strips, strips == 1 ? offsets[0] : addArray(strips, 4, [&offsets] (size_t i) { return offsets[i]; }));
+    addEntry(277, 3, 1, samples);
+    addEntry(278, 4, 1, rowsPerStrip);
+    addEntry(279, 4, strips, strips == 1 ? data[0].size() : addArray(strips, 4, [&data] (size_t i) { return data[i].size(); }));
+    addEntry(284, 3, 1, 1);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw string("Error writing file ") + string(path);
+    uint8_t header[8] = {'I', 'I', 42, 0};
+    writeLE<uint32_t>(header + 4, ifdOffset);
+    bool written = writeAll(fd, header, sizeof(header), 0);
+    for (size_t idx = 0; idx < strips && written; ++idx)
+        written = writeAll(fd, data[idx].data(), data[idx].size(), offsets[idx]);
+    written = written && writeAll(fd, ifd.data(), ifd.size(), ifdOffset) &&
+              writeAll(fd, arrays.data(), arrays.size(), arraysOffset);
+    if (close(fd) != 0 || !written)
         throw string("Error writing file ") + string(path);
 }
+
+}
+
+bool is_tiff_path(const char *path)
+{
+    string name(path);
+    size_t dot = name.rfind('.');
+    if (dot == string::npos)
+        return false;
+    string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [] (char c) { return std::tolower(c); });
+    return ext == "tif" || ext == "tiff";
+}
+
+PlanarImage16 load_tiff(const char *path)
+{
+    TiffFile tiff;
+    openTiff(path, &tiff);
+    if (tiff.samplesPerPixel < 3) {
+        Plane16 gray(tiff.height, tiff.width);
+        decodeTiff(tiff, [&gray] (size_t row, uint col, size_t sample, uint value) {
+            if (sample == 0)
+                gray.row_ptr(row)[col] = value;
+        });
+        return PlanarImage16(gray, gray.copy(), gray.copy());
+    }
+    PlanarImage16 res(tiff.height, tiff.width);
+    decodeTiff(tiff, [&res] (size_t row, uint col, size_t sample, uint value) {
+        res.plane(sample).row_ptr(row)[col] = value;
+    });
+    return res;
+}
+
+Plane16 load_tiff_plane(const char *path, size_t channel)
+{
+    if (channel >= 3)
+        throw string("no such channel");
+    TiffFile tiff;
+    openTiff(path, &tiff);
+    if (tiff.samplesPerPixel < 3)
+        channel = 0;
+    Plane16 res(tiff.height, tiff.width);
+    decodeTiff(tiff, [&res, channel] (size_t row, uint col, size_t sample, uint value) {
+        if (sample == channel)
+            res.row_ptr(row)[col] = value;
+    });
+    return res;
+}
+
+void save_tiff(const PlanarImage16 &im, const char *path, bool packBits)
+{
+    writeTiff(path, im.n_rows(), im.n_cols(), 3, packBits, [&im] (size_t row, uint16_t *dst) {
+        const uint16_t *r = im.red.row_ptr(row);
+        const uint16_t *g = im.green.row_ptr(row);
+        const uint16_t *b = im.blue.row_ptr(row);
+        for (uint j = 0; j < im.n_cols(); ++j, dst += 3) {
+            dst[0] = r[j];
+            dst[1] = g[j];
+            dst[2] = b[j];
+        }
+    });
+}
+
+void save_tiff(const Plane16 &plane, const char *path, bool packBits)
+{
+    writeTiff(path, plane.n_rows, plane.n_cols, 1, packBits, [&plane] (size_t row, uint16_t *dst) {
+        std::copy_n(plane.row_ptr(row), plane.n_cols, dst);
+    });
+}
+
+ImageInfo probe_image(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        throw string("Error reading file ") + string(path);
+    struct stat stats;
+    uint8_t data[54 + 256 * 4 + 256];
+    ssize_t available = 0;
+    if (fstat(fd, &stats) == 0)
+        available = pread(fd, data, sizeof(data), 0);
+    close(fd);
+
+    ImageInfo info;
+    if (available >= 4 && ((data[0] == 'I' && data[1] == 'I' && data[2] == 42 && data[3] == 0) ||
+                           (data[0] == 'M' && data[1] == 'M' && data[2] == 0 && data[3] == 42))) {
+        // pixels of mapped file are not touched.
+        TiffFile tiff;
+        openTiff(path, &tiff);
+        info.format = ImageFormat::TIFF;
+        info.n_rows = tiff.height;
+        info.n_cols = tiff.width;
+        info.bitsPerSample = tiff.bitsPerSample;
+        info.channels = tiff.samplesPerPixel < 3 ? 1 : 3;
+        info.partialReads = false;
+        return info;
+    }
+
+    if (available < 54 || data[0] != 'B' || data[1] != 'M')
+        throw string("Unknown image format of ") + string(path);
+    // files, which only EasyBMP reads, still have usual header.
+    BmpReader::Header header;
+    const bool native = header.parse(data, available, stats.st_size);
+    const int32_t height = readLE<int32_t>(data + 22);
+    info.format = ImageFormat::BMP;
+    info.n_rows = height < 0 ? -static_cast<int64_t>(height) : height;
+    info.n_cols = std::max(readLE<int32_t>(data + 18), 0);
+    info.bitsPerSample = 8;
+    info.channels = native && header.gray ? 1 : 3;
+    info.partialReads = native;
+    return info;
+}
@@ -93,9 +93,17 @@ void parse_args(char **argv, int argc, bool *isPostprocessing, string *postproce
 
 int main(int argc, char **argv)
 {
+    // writes to shared matrices copy them, so copies of planes are lazy.
+    set_copy_on_write(true);
     Model model;
     ConsoleController consoleController(&model);
-    consoleController.run(argc, argv);
+    try {
+        consoleController.run(argc, argv);
+    } catch (const string &s) {
+        cerr << "Error: " << s << endl;
+        cerr << "For help type: " << endl << argv[0] << " --help" << endl;
+        return 1;
+    }
     return 0;
 /*
     try {
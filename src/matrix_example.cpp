@@ -37,6 +37,9 @@ public:
     }
     // Radius of neighbourhoud, which is passed to that operator
     static const int radius = 1;
+    // Size of neighbourhood, unary_map takes it from these fields
+    static const uint n_rows = 2 * radius + 1;
+    static const uint n_cols = 2 * radius + 1;
 };
 
 int main(int argc, char **argv)
@@ -3,10 +3,15 @@
 #include "io.h"
 #include "plugin_manager.h"
 #include "plugin_utils.h"
+#include "buffer_pool.h"
 
+#include <cstdint>
 #include <numeric>
 #include <string>
 #include <iostream>
+#include <sstream>
+
+#include <unistd.h>
 
 static void checkArgcCount(int argc, int from, int to = std::numeric_limits<int>::max()) {
     if (argc < from)
@@ -16,7 +21,16 @@ static void checkArgcCount(int argc, int from, int to = std::numeric_limits<int>
 }
 
 static void printHelp(const char* argv0) {
-    std::cout << "Usage: " << argv0 << " <input_image_path> <output_image_path> <logfile_path> [--filter]" << std::endl;
+    std::cout << "Usage: " << argv0 << " <input_image_path> <output_image_path> <logfile_path>"
+              << " [--filter] [--streaming] [--memory-limit <MiB>]" << std::endl;
+}
+
+// Half of physical memory.
+static size_t defaultMemoryLimit() {
+    long pages = sysconf(_SC_PHYS_PAGES), pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || pageSize <= 0)
+        return std::numeric_limits<size_t>::max();
+    return static_cast<size_t>(pages) * pageSize / 2;
 }
 
 void ConsoleController::run(int argc, char* argv[]) {
@@ -26,21 +40,48 @@ void ConsoleController::run(int argc, char* argv[]) {
         return;
     }
 
-    checkArgcCount(argc, 4, 5);
+    checkArgcCount(argc, 4, 8);
 
     bool isFilter = false;
+    bool isStreaming = false;
+    size_t memoryLimit = defaultMemoryLimit();
 
-    if (argc == 5) {
-        if (std::string(argv[4]) == "--filter")
+    for (int i = 4; i < argc; ++i) {
+        if (std::string(argv[i]) == "--filter") {
             isFilter = true;
-        else
-            throw std::string("unknown option ") + std::string(argv[4]);
+        } else if (std::string(argv[i]) == "--streaming") {
+            isStreaming = true;
+        } else if (std::string(argv[i]) == "--memory-limit" && i + 1 < argc) {
+            std::istringstream value(argv[++i]);
+            size_t megabytes = 0;
+            if (!(value >> megabytes) || !value.eof() || megabytes > (SIZE_MAX >> 20))
+                throw std::string("bad memory limit ") + std::string(argv[i]);
+            memoryLimit = megabytes << 20;
+        } else {
+            throw std::string("unknown option ") + std::string(argv[i]);
+        }
     }
+    if (isFilter && isStreaming)
+        throw std::string("--filter can't be applied to streamed result");
 
     const char* srcImageName = argv[1];
     const char* dstImageName = argv[2];
     const char* logFileName = argv[3];
 
+    // Streamed result is written by bands of BMP rows only.
+    if (isStreaming && is_tiff_path(dstImageName))
+        throw std::string("streamed result can't be written to TIFF file ") + std::string(dstImageName);
+
+    // Plan job by header: plates, which don't fit in memory, are streamed
+    // (BMP to BMP only), pool caches no more than working set of the job.
+    ImageInfo info = probe_image(srcImageName);
+    size_t memoryCost = Model::alignMemoryCost(info);
+    if (!isFilter && info.format == ImageFormat::BMP && !is_tiff_path(dstImageName) && memoryCost > memoryLimit)
+        isStreaming = true;
+    BufferPool& pool = BufferPool::global();
+    pool.setMaxCachedBytes(std::min(memoryCost, memoryLimit));
+    pool.setHugePages(info.planeBytes() >= BufferPool::hugePageSize);
+
     FilterPluginManager manager;
     IFilterPlugin* plugin = nullptr;
 
@@ -75,6 +116,11 @@ void ConsoleController::run(int argc, char* argv[]) {
     model->addObserver(textView.get());
     model->addObserver(imageView.get());
 
+    if (isStreaming) {
+        model->alignStreaming(srcImageName, dstImageName);
+        return;
+    }
+
     model->align(srcImageName, false, false, 0);
     if (plugin)
         model->processResult(*plugin);
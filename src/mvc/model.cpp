@@ -1,49 +1,116 @@
 #include "mvc/model.h"
 #include "align_help.h"
 
-Image loadImage(const char* name) {
-    Image srcImage = load_image(name);
-    return srcImage;
+// Small 8-bit plates are cropped by edges. Thresholds of canny are for
+// 8-bit samples, so 16-bit plates are always cropped by fixed fractions.
+static Plane8 cropSmallChannel(const Plane8& im)
+{
+    return cropImage(im, 10, 30, im.n_rows * 0.07, im.n_cols * 0.07, 2);
+}
+
+static Plane16 cropSmallChannel(const Plane16& im)
+{
+    return simpleCropImage(im, 0.04, 0.05);
+}
+
+// 16-bit samples reduced to 8 bits.
+static Image toImage8(const PlanarImage16& image)
+{
+    Image res(image.n_rows(), image.n_cols());
+    for (size_t row = 0; row < res.n_rows; ++row) {
+        auto* dst = res.row_ptr(row);
+        for (size_t col = 0; col < res.n_cols; ++col)
+            dst[col] = std::make_tuple(image.red.row_ptr(row)[col] >> 8, image.green.row_ptr(row)[col] >> 8,
+                                       image.blue.row_ptr(row)[col] >> 8);
+    }
+    return res;
+}
+
+// Samples of 8-bit TIFF plate, which are decoded to 16-bit plane unscaled.
+static Plane8 toPlane8(const Plane16& plate)
+{
+    Plane8 res = Plane8::uninitialized(plate.n_rows, plate.n_cols);
+    for (size_t row = 0; row < res.n_rows; ++row) {
+        const uint16_t* src = plate.row_ptr(row);
+        uint8_t* dst = res.row_ptr(row);
+        for (size_t col = 0; col < res.n_cols; ++col)
+            dst[col] = static_cast<uint8_t>(src[col]);
+    }
+    return res;
 }
 
 void Model::align(const Image& srcImage, bool isInterp, bool isSubpixel, double subScale)
 {
+    align(extractPlane<uint8_t>(srcImage, 0), isInterp, isSubpixel, subScale);
+}
 
-    static const double pyramidScale = 0.5;
+void Model::align(const Plane8& srcPlate, bool isInterp, bool isSubpixel, double subScale)
+{
+    resImage = toImage(alignChannels(divideImageOnChannels(srcPlate), isInterp, isSubpixel, subScale));
+    resImage16 = {};
+    notifyObservers(ImagesWasAligned());
+}
+
+void Model::align(const Plane16& srcPlate, bool isInterp, bool isSubpixel, double subScale)
+{
+    resImage16 = alignChannels(divideImageOnChannels(srcPlate), isInterp, isSubpixel, subScale);
+    resImage = toImage8(resImage16);
+    notifyObservers(ImagesWasAligned());
+}
+
+PlanarImage16 Model::getResultImage16() const
+{
+    if (resImage16.n_rows() > 0 && resImage16.n_cols() > 0)
+        return resImage16;
+    Image image = getResultImage();
+    PlanarImage16 res = toPlanar<uint16_t>(image);
+    for (size_t ch = 0; ch < 3; ++ch) {
+        Plane16& plane = res.plane(ch);
+        for (size_t row = 0; row < plane.n_rows; ++row) {
+            uint16_t* dst = plane.row_ptr(row);
+            for (size_t col = 0; col < plane.n_cols; ++col)
+                dst[col] *= 257;
+        }
+    }
+    return res;
+}
 
-    auto images = divideImageOnChannels(srcImage);
+template <typename ChannelT>
+PlanarImage<ChannelT> Model::alignChannels(std::vector<Matrix<ChannelT>> images, bool isInterp, bool isSubpixel, double subScale)
+{
+    typedef Matrix<ChannelT> Plane;
+
+    static const double pyramidScale = 0.5;
 
     notifyObservers(ImageWasDividedOnChannels());
 
     if (isSubpixel) {
         std::for_each(images.begin(), images.end(),
-                [subScale, isInterp] (Image& im) { im = isInterp ? bicubicResize(im, subScale) : resize(im, subScale); });
+                [subScale, isInterp] (Plane& im) { im = isInterp ? bicubicResize(im, subScale) : resize(im, subScale); });
     }
 
     bool willCroped = images[0].n_rows * images[0].n_cols <= 500000;
 
-    std::vector<Image> tmpImages;
+    // channels are not written, so uncropped ones are shared, not copied.
+    std::vector<Plane> tmpImages;
 
-    if (!willCroped) {
-        for (auto &image : images)
-            tmpImages.push_back(image.deep_copy());
-    }
+    if (!willCroped)
+        tmpImages = images;
 
     std::for_each(images.begin(), images.end(),
-            willCroped ? [] (Image& im) { im = cropImage(im, 10, 30, im.n_rows * 0.07, im.n_cols * 0.07, 2); }
-            : [] (Image& im) { im = simpleCropImage(im, 0.04, 0.05); });
+            [willCroped] (Plane& im) { im = willCroped ? cropSmallChannel(im) : simpleCropImage(im, 0.04, 0.05); });
 
     notifyObservers(ImagesWasCropped());
 
-    std::vector<std::vector<Image>> pyramids(images.size());
+    std::vector<std::vector<Plane>> pyramids(images.size());
 
     for (size_t i = 0; i < images.size(); ++i)
         pyramids[i] = getImagesPyramid(images[i], pyramidScale, 300, isInterp);
 
     static const int maxShift = 30;
 
-    auto shift0 = getBestShiftForPyramids(pyramids[1], pyramids[0], getBestShiftByMSE, maxShift, 2, pyramidScale);
-    auto shift2 = getBestShiftForPyramids(pyramids[1], pyramids[2], getBestShiftByMSE, maxShift, 2, pyramidScale);
+    auto shift0 = getBestShiftForPyramids(pyramids[1], pyramids[0], getBestShiftByBoundedMSE<ChannelT>, maxShift, 2, pyramidScale);
+    auto shift2 = getBestShiftForPyramids(pyramids[1], pyramids[2], getBestShiftByBoundedMSE<ChannelT>, maxShift, 2, pyramidScale);
 
     auto ans = mergeImages(willCroped ? images[1] : tmpImages[1],
                            willCroped ? images[0] : tmpImages[0],
@@ -53,17 +120,47 @@ void Model::align(const Image& srcImage, bool isInterp, bool isSubpixel, double
 
 
     if (isSubpixel) {
-        ans = isInterp ? bicubicResize(ans, 1 / subScale) : resize(ans, 1 / subScale);
+        for (size_t i = 0; i < 3; ++i)
+            ans.plane(i) = isInterp ? bicubicResize(ans.plane(i), 1 / subScale) : resize(ans.plane(i), 1 / subScale);
     }
 
-    resImage = ans;
-    notifyObservers(ImagesWasAligned());
+    return ans;
+}
+
+size_t Model::alignMemoryCost(const ImageInfo& info)
+{
+    const size_t resultPixels = static_cast<size_t>(info.n_rows) / 3 * info.n_cols;
+    // plate, cropped channels with pyramids and planar merge take about
+    // a plate each, result Image takes 12 bytes per pixel and its file 3.
+    return info.planeBytes() * 4 + resultPixels * (12 + 3);
 }
 
 void Model::align(const char *srcImageName, bool isInterp, bool isSubpixel, double subScale)
 {
-    Image srcImage = loadImage(srcImageName);
+    resImage = {};
+    ImageInfo info = probe_image(srcImageName);
+    if (info.format == ImageFormat::TIFF) {
+        Plane16 srcPlate = load_tiff_plane(srcImageName);
+        notifyObservers(LoadImageNotification());
+        // 8-bit scans are aligned like BMP plates.
+        if (info.bitsPerSample == 8)
+            align(toPlane8(srcPlate), isInterp, isSubpixel, subScale);
+        else
+            align(srcPlate, isInterp, isSubpixel, subScale);
+        return;
+    }
+    auto channels = loadPlateChannels(srcImageName);
     notifyObservers(LoadImageNotification());
+    resImage = toImage(alignChannels(channels, isInterp, isSubpixel, subScale));
+    resImage16 = {};
+    notifyObservers(ImagesWasAligned());
+}
+
+void Model::alignStreaming(const char *srcImageName, const char *dstImageName)
+{
     resImage = {};
-    align(srcImage, isInterp, isSubpixel, subScale);
+    resImage16 = {};
+    notifyObservers(LoadImageNotification());
+    alignPlateStreaming(srcImageName, dstImageName);
+    notifyObservers(ImagesWasAlignedToFile());
 }
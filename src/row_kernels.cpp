@@ -0,0 +1,401 @@
+#include "row_kernels.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ROW_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+template <typename T>
+static uint64_t scalarSquaredDiff(const T* row1, const T* row2, size_t count) {
+    uint64_t res = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int64_t d = static_cast<int64_t>(row1[i]) - static_cast<int64_t>(row2[i]);
+        res += static_cast<uint64_t>(d * d);
+    }
+    return res;
+}
+
+template <typename T>
+static uint64_t scalarDot(const T* row1, const T* row2, size_t count) {
+    uint64_t res = 0;
+    for (size_t i = 0; i < count; ++i)
+        res += static_cast<uint64_t>(row1[i]) * row2[i];
+    return res;
+}
+
+template <typename T>
+static uint64_t scalarAbsDiff(const T* row1, const T* row2, size_t count) {
+    uint64_t res = 0;
+    for (size_t i = 0; i < count; ++i)
+        res += row1[i] > row2[i] ? row1[i] - row2[i] : row2[i] - row1[i];
+    return res;
+}
+
+namespace {
+
+struct Kernels {
+    uint64_t (*squaredDiff8)(const uint8_t*, const uint8_t*, size_t);
+    uint64_t (*squaredDiff16)(const uint16_t*, const uint16_t*, size_t);
+    uint64_t (*dot8)(const uint8_t*, const uint8_t*, size_t);
+    uint64_t (*dot16)(const uint16_t*, const uint16_t*, size_t);
+    uint64_t (*absDiff8)(const uint8_t*, const uint8_t*, size_t);
+    uint64_t (*absDiff16)(const uint16_t*, const uint16_t*, size_t);
+};
+
+const Kernels scalarKernels = {
+    scalarSquaredDiff<uint8_t>, scalarSquaredDiff<uint16_t>,
+    scalarDot<uint8_t>, scalarDot<uint16_t>,
+    scalarAbsDiff<uint8_t>, scalarAbsDiff<uint16_t>
+};
+
+}
+
+#ifdef ROW_KERNELS_X86
+
+// 32-bit accumulators of 8-bit kernels grow by at most 2 * 2 * 255^2 per
+// step and those of 16-bit SAD by 2 * 65535, so they are flushed to 64-bit
+// sum after that many steps, long before overflow.
+static const size_t maxSteps8 = 4096;
+static const size_t maxStepsAbsDiff16 = 16384;
+
+// Sum of 32-bit lanes as unsigned values.
+__attribute__((target("sse2")))
+static uint64_t sumLanes32(__m128i acc) {
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    return static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("sse2")))
+static uint64_t sumLanes64(__m128i acc) {
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("sse2")))
+static __m128i load(const void* ptr) {
+    return _mm_loadu_si128(static_cast<const __m128i*>(ptr));
+}
+
+// |a - b| of unsigned 16-bit lanes.
+__attribute__((target("sse2")))
+static __m128i absDiff16(__m128i a, __m128i b) {
+    return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+// Sum of 64-bit products of even and odd 32-bit lanes of a and b.
+__attribute__((target("sse2")))
+static __m128i mulAdd32(__m128i a, __m128i b) {
+    return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)));
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2SquaredDiff8(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vectorEnd = count - count % 16;
+    uint64_t res = 0;
+    size_t i = 0;
+    while (i < vectorEnd) {
+        const size_t blockEnd = std::min(vectorEnd, i + 16 * maxSteps8);
+        __m128i acc = zero;
+        for (; i < blockEnd; i += 16) {
+            __m128i a = load(row1 + i), b = load(row2 + i);
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        res += sumLanes32(acc);
+    }
+    return res + scalarSquaredDiff(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2Dot8(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vectorEnd = count - count % 16;
+    uint64_t res = 0;
+    size_t i = 0;
+    while (i < vectorEnd) {
+        const size_t blockEnd = std::min(vectorEnd, i + 16 * maxSteps8);
+        __m128i acc = zero;
+        for (; i < blockEnd; i += 16) {
+            __m128i a = load(row1 + i), b = load(row2 + i);
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(lo, hi));
+        }
+        res += sumLanes32(acc);
+    }
+    return res + scalarDot(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2AbsDiff8(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    const size_t vectorEnd = count - count % 16;
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i < vectorEnd; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(load(row1 + i), load(row2 + i)));
+    return sumLanes64(acc) + scalarAbsDiff(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2SquaredDiff16(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vectorEnd = count - count % 8;
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i < vectorEnd; i += 8) {
+        __m128i d = absDiff16(load(row1 + i), load(row2 + i));
+        __m128i lo = _mm_unpacklo_epi16(d, zero), hi = _mm_unpackhi_epi16(d, zero);
+        acc = _mm_add_epi64(acc, _mm_add_epi64(mulAdd32(lo, lo), mulAdd32(hi, hi)));
+    }
+    return sumLanes64(acc) + scalarSquaredDiff(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2Dot16(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vectorEnd = count - count % 8;
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i < vectorEnd; i += 8) {
+        __m128i a = load(row1 + i), b = load(row2 + i);
+        __m128i lo = mulAdd32(_mm_unpacklo_epi16(a, zero), _mm_unpacklo_epi16(b, zero));
+        __m128i hi = mulAdd32(_mm_unpackhi_epi16(a, zero), _mm_unpackhi_epi16(b, zero));
+        acc = _mm_add_epi64(acc, _mm_add_epi64(lo, hi));
+    }
+    return sumLanes64(acc) + scalarDot(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2AbsDiff16(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vectorEnd = count - count % 8;
+    uint64_t res = 0;
+    size_t i = 0;
+    while (i < vectorEnd) {
+        const size_t blockEnd = std::min(vectorEnd, i + 8 * maxStepsAbsDiff16);
+        __m128i acc = zero;
+        for (; i < blockEnd; i += 8) {
+            __m128i d = absDiff16(load(row1 + i), load(row2 + i));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(d, zero), _mm_unpackhi_epi16(d, zero)));
+        }
+        res += sumLanes32(acc);
+    }
+    return res + scalarAbsDiff(row1 + i, row2 + i, count - i);
+}
+
+// AVX2 versions do the same on 256-bit vectors. Unpacks work within
+// 128-bit halves, which doesn't matter for sums.
+
+__attribute__((target("avx2")))
+static uint64_t sumLanes32(__m256i acc) {
+    uint32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    uint64_t res = 0;
+    for (uint32_t lane : lanes)
+        res += lane;
+    return res;
+}
+
+__attribute__((target("avx2")))
+static uint64_t sumLanes64(__m256i acc) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static __m256i load256(const void* ptr) {
+    return _mm256_loadu_si256(static_cast<const __m256i*>(ptr));
+}
+
+__attribute__((target("avx2")))
+static __m256i absDiff16(__m256i a, __m256i b) {
+    return _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a));
+}
+
+__attribute__((target("avx2")))
+static __m256i mulAdd32(__m256i a, __m256i b) {
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2SquaredDiff8(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vectorEnd = count - count % 32;
+    uint64_t res = 0;
+    size_t i = 0;
+    while (i < vectorEnd) {
+        const size_t blockEnd = std::min(vectorEnd, i + 32 * maxSteps8);
+        __m256i acc = zero;
+        for (; i < blockEnd; i += 32) {
+            __m256i a = load256(row1 + i), b = load256(row2 + i);
+            __m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+            __m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+        res += sumLanes32(acc);
+    }
+    return res + sse2SquaredDiff8(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2Dot8(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vectorEnd = count - count % 32;
+    uint64_t res = 0;
+    size_t i = 0;
+    while (i < vectorEnd) {
+        const size_t blockEnd = std::min(vectorEnd, i + 32 * maxSteps8);
+        __m256i acc = zero;
+        for (; i < blockEnd; i += 32) {
+            __m256i a = load256(row1 + i), b = load256(row2 + i);
+            __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+            __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(lo, hi));
+        }
+        res += sumLanes32(acc);
+    }
+    return res + sse2Dot8(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2AbsDiff8(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    const size_t vectorEnd = count - count % 32;
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i < vectorEnd; i += 32)
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(load256(row1 + i), load256(row2 + i)));
+    return sumLanes64(acc) + sse2AbsDiff8(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2SquaredDiff16(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vectorEnd = count - count % 16;
+    __m256i acc = zero;
+    size_t i = 0;
+    for (; i < vectorEnd; i += 16) {
+        __m256i d = absDiff16(load256(row1 + i), load256(row2 + i));
+        __m256i lo = _mm256_unpacklo_epi16(d, zero), hi = _mm256_unpackhi_epi16(d, zero);
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(mulAdd32(lo, lo), mulAdd32(hi, hi)));
+    }
+    return sumLanes64(acc) + sse2SquaredDiff16(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2Dot16(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vectorEnd = count - count % 16;
+    __m256i acc = zero;
+    size_t i = 0;
+    for (; i < vectorEnd; i += 16) {
+        __m256i a = load256(row1 + i), b = load256(row2 + i);
+        __m256i lo = mulAdd32(_mm256_unpacklo_epi16(a, zero), _mm256_unpacklo_epi16(b, zero));
+        __m256i hi = mulAdd32(_mm256_unpackhi_epi16(a, zero), _mm256_unpackhi_epi16(b, zero));
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(lo, hi));
+    }
+    return sumLanes64(acc) + sse2Dot16(row1 + i, row2 + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2AbsDiff16(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vectorEnd = count - count % 16;
+    uint64_t res = 0;
+    size_t i = 0;
+    while (i < vectorEnd) {
+        const size_t blockEnd = std::min(vectorEnd, i + 16 * maxStepsAbsDiff16);
+        __m256i acc = zero;
+        for (; i < blockEnd; i += 16) {
+            __m256i d = absDiff16(load256(row1 + i), load256(row2 + i));
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_unpacklo_epi16(d, zero), _mm256_unpackhi_epi16(d, zero)));
+        }
+        res += sumLanes32(acc);
+    }
+    return res + sse2AbsDiff16(row1 + i, row2 + i, count - i);
+}
+
+namespace {
+
+const Kernels sse2Kernels = {
+    sse2SquaredDiff8, sse2SquaredDiff16,
+    sse2Dot8, sse2Dot16,
+    sse2AbsDiff8, sse2AbsDiff16
+};
+
+const Kernels avx2Kernels = {
+    avx2SquaredDiff8, avx2SquaredDiff16,
+    avx2Dot8, avx2Dot16,
+    avx2AbsDiff8, avx2AbsDiff16
+};
+
+}
+
+#endif
+
+SimdLevel supportedSimdLevel() {
+#ifdef ROW_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+#endif
+    return SimdLevel::SCALAR;
+}
+
+static SimdLevel& currentLevel() {
+    static SimdLevel level = supportedSimdLevel();
+    return level;
+}
+
+static const Kernels& kernels() {
+    switch (currentLevel()) {
+#ifdef ROW_KERNELS_X86
+    case SimdLevel::AVX2:
+        return avx2Kernels;
+    case SimdLevel::SSE2:
+        return sse2Kernels;
+#endif
+    default:
+        return scalarKernels;
+    }
+}
+
+SimdLevel simdLevel() {
+    return currentLevel();
+}
+
+void setSimdLevel(SimdLevel level) {
+    currentLevel() = std::min(level, supportedSimdLevel());
+}
+
+uint64_t rowSquaredDiff(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    return kernels().squaredDiff8(row1, row2, count);
+}
+
+uint64_t rowSquaredDiff(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    return kernels().squaredDiff16(row1, row2, count);
+}
+
+uint64_t rowDot(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    return kernels().dot8(row1, row2, count);
+}
+
+uint64_t rowDot(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    return kernels().dot16(row1, row2, count);
+}
+
+uint64_t rowAbsDiff(const uint8_t* row1, const uint8_t* row2, size_t count) {
+    return kernels().absDiff8(row1, row2, count);
+}
+
+uint64_t rowAbsDiff(const uint16_t* row1, const uint16_t* row2, size_t count) {
+    return kernels().absDiff16(row1, row2, count);
+}
@@ -3,6 +3,13 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <filters.h>
+#include <integral_image.h>
+#include <io.h>
+#include <fft.h>
+#include <row_kernels.h>
+#include <mvc/model.h>
+#include <cstdio>
+#include <fstream>
 
 template <typename T>
 bool doubleEqual(const T& val1, const T& val2, const T& eps) {
@@ -254,6 +261,79 @@ TEST(Images, calculateMSE) {
     }
 }
 
+TEST(Images, calculateMSEByRows) {
+    srand(17);
+    Plane8 image1(23, 31), image2(19, 27);
+    Plane16 deep1(23, 31), deep2(19, 27);
+    for (size_t row = 0; row < image1.n_rows; ++row) {
+        for (size_t col = 0; col < image1.n_cols; ++col) {
+            image1(row, col) = rand() % 256;
+            deep1(row, col) = rand() % 65536;
+        }
+    }
+    for (size_t row = 0; row < image2.n_rows; ++row) {
+        for (size_t col = 0; col < image2.n_cols; ++col) {
+            image2(row, col) = rand() % 256;
+            deep2(row, col) = rand() % 65536;
+        }
+    }
+
+    // row kernels give exactly the per-pixel sums.
+    auto squaredDiff = [] (size_t val1, size_t val2) {
+        long long d = static_cast<long long>(val1) - static_cast<long long>(val2);
+        return d * d;
+    };
+    for (int dr = -10; dr <= 10; ++dr) {
+        for (int dc = -10; dc <= 10; ++dc) {
+            auto cross = crossImages(image1, image2, dr, dc);
+            const long double area = cross.height * cross.width;
+            ASSERT_EQ(calculateMSE(image1, image2, dr, dc), calculateSum(image1, image2, dr, dc, squaredDiff) / area);
+            ASSERT_EQ(calculateMSE(deep1, deep2, dr, dc), calculateSum(deep1, deep2, dr, dc, squaredDiff) / area);
+        }
+    }
+    ASSERT_THROW(calculateMSE(image1, image2, 23, 0), std::logic_error);
+}
+
+TEST(Images, RowKernels) {
+    srand(29);
+    // long rows with extreme values check flushes of narrow accumulators.
+    const size_t count = 300001;
+    std::vector<uint8_t> a8(count), b8(count);
+    std::vector<uint16_t> a16(count), b16(count);
+    for (size_t i = 0; i < count; ++i) {
+        bool extreme = i < count / 2;
+        a8[i] = extreme ? 255 : rand() % 256;
+        b8[i] = extreme ? 0 : rand() % 256;
+        a16[i] = extreme ? 65535 : rand() % 65536;
+        b16[i] = extreme ? (i % 2 ? 0 : 65535) : rand() % 65536;
+    }
+
+    const SimdLevel supported = supportedSimdLevel();
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2}) {
+        setSimdLevel(level);
+        for (size_t len : {size_t(0), size_t(1), size_t(15), size_t(33), size_t(1000), count}) {
+            uint64_t ssd8 = 0, dot8 = 0, sad8 = 0, ssd16 = 0, dot16 = 0, sad16 = 0;
+            for (size_t i = 0; i < len; ++i) {
+                long long d8 = a8[i] - b8[i], d16 = a16[i] - b16[i];
+                ssd8 += d8 * d8;
+                dot8 += a8[i] * b8[i];
+                sad8 += std::abs(d8);
+                ssd16 += d16 * d16;
+                dot16 += uint64_t(a16[i]) * b16[i];
+                sad16 += std::abs(d16);
+            }
+            ASSERT_EQ(rowSquaredDiff(a8.data(), b8.data(), len), ssd8);
+            ASSERT_EQ(rowDot(a8.data(), b8.data(), len), dot8);
+            ASSERT_EQ(rowAbsDiff(a8.data(), b8.data(), len), sad8);
+            ASSERT_EQ(rowSquaredDiff(a16.data(), b16.data(), len), ssd16);
+            ASSERT_EQ(rowDot(a16.data(), b16.data(), len), dot16);
+            ASSERT_EQ(rowAbsDiff(a16.data(), b16.data(), len), sad16);
+        }
+    }
+    setSimdLevel(supported);
+    ASSERT_EQ(simdLevel(), supported);
+}
+
 TEST(Images, calculateCrossCorrelation) {
      {
         Image image1(2, 2), image2(2, 2);
@@ -303,10 +383,26 @@ TEST(Images, calculateCrossCorrelation) {
 }
 
 TEST(Images, getBestShiftImpl) {
-    auto bestShift = getBestShiftImpl(-15, 15, -15, 15, [] (int dr, int dc) { return (dr + dc - 5 + 15) % 15; }, ActionType::MAXIMIZE);
+    auto bestShift = getBestShiftImpl(-15, 15, -15, 15, [] (int dr, int dc) { return (dr + dc - 5 + 45) % 15; }, ActionType::MAXIMIZE);
     ASSERT_EQ((bestShift.first + bestShift.second - 5 + 150) % 15, 14);
-    bestShift = getBestShiftImpl(-15, 15, -15, 15, [] (int dr, int dc) { return (dr + dc - 5 + 15) % 15; }, ActionType::MINIMIZE);
+    bestShift = getBestShiftImpl(-15, 15, -15, 15, [] (int dr, int dc) { return (dr + dc - 5 + 45) % 15; }, ActionType::MINIMIZE);
     ASSERT_EQ((bestShift.first + bestShift.second - 5 + 150) % 15, 0);
+
+    // negative scores of signed keys are compared as they are.
+    bestShift = getBestShiftImpl(-3, 3, -3, 3, [] (int dr, int dc) { return dr * 10 + dc; }, ActionType::MINIMIZE);
+    ASSERT_EQ(bestShift, std::make_pair(-3, -3));
+    bestShift = getBestShiftImpl(-3, 3, -3, 3, [] (int dr, int dc) { return -std::abs(dr) - std::abs(dc); }, ActionType::MAXIMIZE);
+    ASSERT_EQ(bestShift, std::make_pair(0, 0));
+
+    // many equal values in different bands: first one in row-major order wins.
+    bestShift = getBestShiftImpl(-40, 40, -40, 40, [] (int dr, int dc) { return std::abs(dr * dc) % 7 == 3; }, ActionType::MAXIMIZE);
+    ASSERT_EQ(bestShift, std::make_pair(-40, -37));
+    bestShift = getBestShiftImpl(-40, 40, -40, 40, [] (int dr, int dc) { return dr * dr + dc * dc == 25 ? 0 : 1; }, ActionType::MINIMIZE);
+    ASSERT_EQ(bestShift, std::make_pair(-5, 0));
+
+    // fractional values are compared as they are.
+    bestShift = getBestShiftImpl(0, 0, 0, 1, [] (int, int dc) { return dc == 0 ? 10.75L : 10.25L; }, ActionType::MINIMIZE);
+    ASSERT_EQ(bestShift, std::make_pair(0, 1));
 }
 
 TEST(Images, getBestShiftByMSE) {
@@ -344,6 +440,44 @@ TEST(Images, getBestShiftByMSE) {
     }
 }
 
+TEST(Images, getBestShiftByBoundedMSE) {
+    srand(41);
+    Plane8 base(60, 70);
+    Plane16 deep(60, 70);
+    for (size_t row = 0; row < base.n_rows; ++row) {
+        for (size_t col = 0; col < base.n_cols; ++col) {
+            base(row, col) = (row * 7 + col * 3) % 256 ^ (rand() % 32);
+            deep(row, col) = base(row, col) * 257;
+        }
+    }
+    Plane8 image1 = base.submatrix(5, 3, 50, 60), image2 = base.submatrix(9, 1, 48, 62);
+    Plane16 deep1 = deep.submatrix(5, 3, 50, 60), deep2 = deep.submatrix(9, 1, 48, 62);
+    Image tuples1(image1.n_rows, image1.n_cols), tuples2(image2.n_rows, image2.n_cols);
+    for (size_t row = 0; row < image1.n_rows; ++row) {
+        for (size_t col = 0; col < image1.n_cols; ++col)
+            tuples1(row, col) = {image1(row, col), 0, 0};
+    }
+    for (size_t row = 0; row < image2.n_rows; ++row) {
+        for (size_t col = 0; col < image2.n_cols; ++col)
+            tuples2(row, col) = {image2(row, col), 0, 0};
+    }
+    for (int center : {0, -4, 3}) {
+        for (int radius : {1, 5, 12}) {
+            ASSERT_EQ(getBestShiftByBoundedMSE(image1, image2, center - radius, center + radius, center - radius, center + radius),
+                      getBestShiftByMSE(image1, image2, center - radius, center + radius, center - radius, center + radius));
+            ASSERT_EQ(getBestShiftByBoundedMSE(deep1, deep2, center - radius, center + radius, -radius, radius),
+                      getBestShiftByMSE(deep1, deep2, center - radius, center + radius, -radius, radius));
+            ASSERT_EQ(getBestShiftByBoundedMSE(tuples1, tuples2, -radius, radius, center - radius, center + radius),
+                      getBestShiftByMSE(tuples1, tuples2, -radius, radius, center - radius, center + radius));
+        }
+    }
+    ASSERT_EQ(getBestShiftByBoundedMSE(image1, image2, -10, 10, -10, 10), std::make_pair(4, -2));
+
+    // all shifts are equally good: first one in row-major order wins, not the center.
+    Plane8 flat(30, 30);
+    ASSERT_EQ(getBestShiftByBoundedMSE(flat, flat, -3, 3, -2, 2), std::make_pair(-3, -2));
+}
+
 TEST(Images, getBestShiftByCrossCorrelation) {
     {
         Image image1 = { {{1, 1, 1}, {2, 2, 2}},
@@ -444,6 +578,70 @@ TEST(Filters, SepGauss) {
     }
 }
 
+TEST(Filters, FixedKernel) {
+    srand(229);
+    Image im(23, 17);
+    for (size_t row = 0; row < im.n_rows; ++row) {
+        for (size_t col = 0; col < im.n_cols; ++col)
+            im(row, col) = {rand() % 256, rand() % 256, rand() % 256};
+    }
+
+    KernelFilterImpl<double> gauss(getGaussKernel(2, 1.4));
+    ASSERT_TRUE(imagesIsEqual(GaussFilter(2, 1.4).applyToImage(im), im.unary_map(gauss)));
+
+    KernelFilterImpl<int> sobel({{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}});
+    ASSERT_TRUE(imagesIsEqual(im.unary_map(sobelKernelX), im.unary_map(sobel)));
+    ASSERT_TRUE(imagesIsEqual(im.unary_map(sobelKernelX, BorderMode::WRAP), im.unary_map(sobel, BorderMode::WRAP)));
+
+    ASSERT_THROW((FixedKernel<double, 1>::fromMatrix(getGaussKernel(2, 1.4))), std::logic_error);
+
+    // 16-bit samples are clamped to 65535, not to 255.
+    Plane16 deep(5, 5);
+    for (size_t row = 0; row < deep.n_rows; ++row) {
+        for (size_t col = 0; col < deep.n_cols; ++col)
+            deep(row, col) = 40000;
+    }
+    KernelFilterImpl<int> doubling({{0, 0, 0}, {0, 2, 0}, {0, 0, 0}});
+    constexpr FixedKernel<double, 1> box = {{{0, 0, 0}, {0, 0.5, 0}, {0, 0, 0}}};
+    ASSERT_EQ(deep.unary_map(doubling)(2, 2), 65535);
+    ASSERT_EQ(deep.unary_map(box)(2, 2), 20000);
+    ASSERT_EQ(deep.unary_map(KernelFilterImpl<double>(getGaussKernel(1, 1.0)))(2, 2), 40000);
+
+    // clamp range is the range of sample type, not its size.
+    static_assert(PixelTraits<uint8_t>::maxValue == 255, "8-bit samples");
+    static_assert(PixelTraits<std::tuple<uint, uint, uint>>::maxValue == 255, "RGB pixels");
+    Matrix<uint> wide(5, 5);
+    for (size_t row = 0; row < wide.n_rows; ++row) {
+        for (size_t col = 0; col < wide.n_cols; ++col)
+            wide(row, col) = 3000000000u;
+    }
+    ASSERT_EQ(wide.unary_map(box)(2, 2), 1500000000u);
+    ASSERT_EQ(wide.unary_map(KernelFilterImpl<double>({{0, 0, 0}, {0, 2, 0}, {0, 0, 0}}))(2, 2),
+              std::numeric_limits<uint>::max());
+}
+
+TEST(Filters, SeparableTranspose) {
+    srand(233);
+    Image im(37, 70);
+    for (size_t row = 0; row < im.n_rows; ++row) {
+        for (size_t col = 0; col < im.n_cols; ++col)
+            im(row, col) = {rand() % 256, rand() % 256, rand() % 256};
+    }
+    auto transposed = im.transpose();
+    ASSERT_EQ(transposed.n_rows, im.n_cols);
+    ASSERT_EQ(transposed.n_cols, im.n_rows);
+    ASSERT_EQ(transposed(69, 36), im(36, 69));
+    ASSERT_TRUE(imagesIsEqual(transposed.transpose(), im));
+    ASSERT_TRUE(imagesIsEqual(im.submatrix(3, 5, 33, 40).transpose().transpose(), im.submatrix(3, 5, 33, 40)));
+
+    auto kernels = getSepGaussKernel(2, 1.4);
+    KernelFilterImpl<double> horizontal(kernels.first), vertical(kernels.second);
+    for (auto border : {BorderMode::NONE, BorderMode::REFLECT}) {
+        auto twoPass = im.unary_map(horizontal, border).unary_map(vertical, border);
+        ASSERT_TRUE(imagesIsEqual(GaussSepFilter(2, 1.4, border).applyToImage(im), twoPass));
+    }
+}
+
 TEST(Filters, MediansCmp) {
     srand(223);
 
@@ -484,3 +682,753 @@ TEST(Mirror, SimpleTest) {
                                                {{7, 7, 7}, {7, 7, 7}, {8, 8, 8}, {9, 9, 9}, {9, 9, 9}}})));
     }
 }
+
+TEST(Mirror, ReflectBorder) {
+    // 100 * top left element of 5 x 5 neighbourhood plus its bottom right element.
+    struct CornersOp {
+        int operator () (const Matrix<int>& m) const {
+            return 100 * m(0, 0) + m(n_rows - 1, n_cols - 1);
+        }
+
+        size_t n_rows = 5, n_cols = 5;
+    };
+
+    Matrix<int> m = { {1, 2, 3, 4},
+                      {5, 6, 7, 8},
+                      {9, 10, 11, 12} };
+    // rows are extended as 6 5 | 1 2 3 4 | 8 7 and so on, columns same way.
+    Matrix<int> expected = { {611, 512, 512, 611},
+                             {211, 112, 112, 211},
+                             {207, 108, 108, 207} };
+    auto res = m.unary_map(CornersOp(), BorderMode::REFLECT);
+    ASSERT_TRUE(matrixIsEqual(res, expected));
+}
+
+TEST(Planar, Conversions) {
+    Image im = { {{1, 2, 3}, {4, 5, 6}},
+                 {{7, 8, 9}, {10, 11, 12}} };
+    auto planar = toPlanar<uint8_t>(im);
+    ASSERT_EQ(planar.n_rows(), 2);
+    ASSERT_EQ(planar.n_cols(), 2);
+    ASSERT_EQ(planar.green(1, 0), 8);
+    ASSERT_EQ(planar.plane(2)(0, 1), 6);
+    ASSERT_TRUE(imagesIsEqual(toImage(planar), im));
+}
+
+TEST(Planar, ChannelView) {
+    Image im = { {{1, 2, 3}, {4, 5, 6}, {7, 8, 9}},
+                 {{10, 11, 12}, {13, 14, 15}, {16, 17, 18}} };
+    ChannelView<uint> green(im, 1);
+    ASSERT_FALSE(green.isPacked());
+    ASSERT_EQ(green(1, 2), 17u);
+    auto sub = green.submatrix(1, 1, 1, 2);
+    ASSERT_EQ(sub(0, 1), 17u);
+    ASSERT_TRUE(matrixIsEqual(sub.toPlane<uint8_t>(), Plane8({14, 17})));
+    ASSERT_THROW(green.packedRow(0), std::string);
+
+    Plane8 plate = extractPlane<uint8_t>(im, 2);
+    ChannelView<uint8_t> third(plate.submatrix(1, 0, 1, 3));
+    ASSERT_TRUE(third.isPacked());
+    ASSERT_EQ(third.packedRow(0)[2], 18);
+    // view of a plane gives the plane back without copying.
+    ASSERT_EQ(third.toPlane().const_row(0), plate.const_row(1));
+    ASSERT_EQ(third.submatrix(0, 1, 1, 2).toPlane().const_row(0), plate.const_row(1) + 1);
+}
+
+TEST(Planar, AlignmentMatchesImage) {
+    srand(223);
+    Image image1(20, 20), image2(20, 20);
+    for (size_t row = 0; row < 20; ++row) {
+        for (size_t col = 0; col < 20; ++col) {
+            size_t r1 = rand() % 255, r2 = rand() % 255;
+            image1(row, col) = {r1, r1, r1};
+            image2(row, col) = {r2, r2, r2};
+        }
+    }
+    Plane8 plane1 = extractPlane<uint8_t>(image1, 0), plane2 = extractPlane<uint8_t>(image2, 0);
+    for (int dr = -3; dr <= 3; ++dr) {
+        for (int dc = -3; dc <= 3; ++dc) {
+            ASSERT_EQ(calculateMSE(image1, image2, dr, dc), calculateMSE(plane1, plane2, dr, dc));
+            ASSERT_EQ(calculateCrossCorrelation(image1, image2, dr, dc), calculateCrossCorrelation(plane1, plane2, dr, dc));
+        }
+    }
+    ASSERT_TRUE(imagesIsEqual(mergeImages(image1, image2, image1, {1, -1}, {0, 2}),
+                              toImage(mergeImages(plane1, plane2, plane1, {1, -1}, {0, 2}))));
+}
+
+TEST(Matrix, RowAccess) {
+    Matrix<int> m = { {1, 2, 3, 4},
+                      {5, 6, 7, 8},
+                      {9, 10, 11, 12} };
+    ASSERT_TRUE(m.is_contiguous());
+    ASSERT_EQ(m.row_stride(), 4);
+    ASSERT_EQ(m.row_ptr(1)[2], 7);
+
+    auto sub = m.submatrix(1, 1, 2, 2);
+    ASSERT_FALSE(sub.is_contiguous());
+    ASSERT_EQ(sub.row_stride(), 4);
+    ASSERT_EQ(sub.const_row(0)[0], 6);
+    ASSERT_EQ(sub.const_row(1)[1], 11);
+
+    sub.row_ptr(1)[0] = 0;
+    ASSERT_EQ(m(2, 1), 0);
+}
+
+struct SumOp {
+    int operator () (const Matrix<int>& m) const {
+        int sum = 0;
+        for (size_t row = 0; row < m.n_rows; ++row) {
+            for (size_t col = 0; col < m.n_cols; ++col)
+                sum += m(row, col);
+        }
+        return sum;
+    }
+
+    size_t n_rows = 3, n_cols = 3;
+};
+
+TEST(Matrix, UnaryMap) {
+    Matrix<int> m(6, 7);
+    for (size_t row = 0; row < m.n_rows; ++row) {
+        for (size_t col = 0; col < m.n_cols; ++col)
+            m(row, col) = row * 10 + col;
+    }
+    auto sub = m.submatrix(1, 1, 4, 5);
+    auto res = sub.unary_map(SumOp());
+    for (size_t row = 1; row + 1 < sub.n_rows; ++row) {
+        for (size_t col = 1; col + 1 < sub.n_cols; ++col)
+            ASSERT_EQ(res(row, col), 9 * sub(row, col));
+    }
+    ASSERT_EQ(res(0, 0), 0);
+}
+
+TEST(Matrix, BorderModes) {
+    Matrix<int> m = { {1, 2, 3},
+                      {4, 5, 6} };
+    // neighbourhood of (0, 0):
+    // reflect     replicate   constant    wrap
+    // 1 1 2       1 1 2       7 7 7       6 4 5
+    // 1 1 2       1 1 2       7 1 2       3 1 2
+    // 4 4 5       4 4 5       7 4 5       6 4 5
+    ASSERT_EQ(m.unary_map(SumOp(), BorderMode::REFLECT)(0, 0), 21);
+    ASSERT_EQ(m.unary_map(SumOp(), BorderMode::REPLICATE)(0, 0), 21);
+    ASSERT_EQ(m.unary_map(SumOp(), BorderMode::CONSTANT, 7)(0, 0), 47);
+    ASSERT_EQ(m.unary_map(SumOp(), BorderMode::WRAP)(0, 0), 36);
+    ASSERT_EQ(m.unary_map(SumOp(), BorderMode::WRAP)(1, 2), 6 + 15 + 6);
+    ASSERT_EQ(m.unary_map(SumOp(), BorderMode::NONE)(0, 0), 0);
+
+    // border mode works when operator is bigger than matrix.
+    Matrix<int> one = {5};
+    ASSERT_EQ(one.unary_map(SumOp(), BorderMode::REPLICATE)(0, 0), 45);
+
+    // interior pixels don't depend on border mode.
+    Matrix<int> big(5, 6);
+    for (size_t row = 0; row < big.n_rows; ++row) {
+        for (size_t col = 0; col < big.n_cols; ++col)
+            big(row, col) = row * 10 + col;
+    }
+    auto inner = big.unary_map(SumOp()).submatrix(1, 1, 3, 4);
+    ASSERT_TRUE(matrixIsEqual(inner, big.unary_map(SumOp(), BorderMode::CONSTANT, 7).submatrix(1, 1, 3, 4)));
+}
+
+TEST(Matrix, BufferPool) {
+    const int* oldData = nullptr;
+    {
+        Matrix<int> m(300, 200);
+        m(10, 10) = 5;
+        oldData = m.const_row(0);
+    }
+    // freed buffer of the same size class is reused and zeroed again.
+    Matrix<int> m(200, 300);
+    ASSERT_EQ(m.const_row(0), oldData);
+    ASSERT_EQ(m(10, 10), 0);
+
+    Image im(200, 200);
+    ASSERT_EQ(im(199, 199), std::make_tuple(0u, 0u, 0u));
+
+    BufferPool pool;
+    pool.setHugePages(true);
+    {
+        auto buffer = pool.allocate<double>(1 << 20);
+        ASSERT_EQ(buffer.get()[(1 << 20) - 1], 0.0);
+    }
+    ASSERT_EQ(pool.cachedBytes(), 8u << 20);
+    pool.trim();
+    ASSERT_EQ(pool.cachedBytes(), 0u);
+
+    // size classes are quarter-octave steps, not powers of two.
+    pool.allocate<uint8_t>((5 << 20) + 1, false);
+    ASSERT_EQ(pool.cachedBytes(), 6u << 20);
+    pool.setMaxCachedBytes(4 << 20);
+    ASSERT_EQ(pool.cachedBytes(), 0u);
+
+    auto raw = Matrix<int>::uninitialized(30, 40);
+    ASSERT_EQ(raw.n_rows, 30);
+    ASSERT_EQ(raw.n_cols, 40);
+    ASSERT_TRUE(raw.is_contiguous());
+}
+
+TEST(Matrix, CopyOnWrite) {
+    Matrix<int> m = { {1, 2, 3},
+                      {4, 5, 6} };
+    auto alias = m;
+    alias(0, 0) = 7;
+    ASSERT_EQ(m(0, 0), 7);
+    auto owned = m.copy();
+    owned(0, 0) = 1;
+    ASSERT_EQ(m(0, 0), 7);
+
+    set_copy_on_write(true);
+    auto lazy = m.copy();
+    ASSERT_EQ(lazy.const_row(0), m.const_row(0));
+    lazy.row_ptr(0)[1] = 0;
+    ASSERT_NE(lazy.const_row(0), m.const_row(0));
+    ASSERT_EQ(m(0, 1), 2);
+
+    // per-pixel writes detach as well.
+    auto pixels = m.copy();
+    pixels(0, 2) = 0;
+    ASSERT_EQ(m(0, 2), 3);
+    ASSERT_EQ(pixels(0, 2), 0);
+    ASSERT_EQ(pixels(1, 2), 6);
+    const Matrix<int> shared = m;
+    m(1, 0) = 0;
+    ASSERT_EQ(shared(1, 0), 4);
+
+    // submatrix detaches to a matrix of its own size.
+    auto sub = m.submatrix(1, 1, 1, 2);
+    sub.row_ptr(0)[0] = 0;
+    ASSERT_EQ(m(1, 1), 5);
+    ASSERT_TRUE(matrixIsEqual(sub, Matrix<int>({0, 6})));
+    ASSERT_EQ(sub.row_stride(), 2);
+
+    // unary_map windows don't detach.
+    ASSERT_EQ(m.unary_map(SumOp(), BorderMode::REPLICATE)(0, 0), 2 * (7 + 7 + 2) + 0 + 0 + 5);
+    set_copy_on_write(false);
+}
+
+TEST(Matrix, BulkCopy) {
+    Matrix<int> m(300, 400);
+    for (size_t row = 0; row < m.n_rows; ++row) {
+        for (size_t col = 0; col < m.n_cols; ++col)
+            m(row, col) = row * 1000 + col;
+    }
+    ASSERT_TRUE(matrixIsEqual(m.deep_copy(), m));
+    auto sub = m.submatrix(10, 20, 250, 300);
+    auto subCopy = sub.deep_copy();
+    ASSERT_TRUE(matrixIsEqual(subCopy, sub));
+    ASSERT_TRUE(subCopy.is_contiguous());
+
+    ASSERT_EQ(m.materialize().const_row(0), m.const_row(0));
+    ASSERT_NE(sub.materialize().const_row(0), sub.const_row(0));
+    ASSERT_NE(m.submatrix(0, 0, 299, 400).materialize().const_row(0), m.const_row(0));
+    ASSERT_EQ(subCopy.materialize().const_row(0), subCopy.const_row(0));
+}
+
+TEST(Matrix, IntegralImage) {
+    srand(231);
+    Plane8 plane(150, 700);
+    for (size_t row = 0; row < plane.n_rows; ++row) {
+        for (size_t col = 0; col < plane.n_cols; ++col)
+            plane(row, col) = rand() % 256;
+    }
+    IntegralImage sums(plane), squares(plane, IntegralValue::SQUARE);
+    ASSERT_EQ(sums.n_rows(), plane.n_rows);
+    ASSERT_EQ(sums.n_cols(), plane.n_cols);
+
+    for (size_t i = 0; i < 20; ++i) {
+        uint row = rand() % plane.n_rows, col = rand() % plane.n_cols;
+        uint rows = rand() % (plane.n_rows - row + 1), cols = rand() % (plane.n_cols - col + 1);
+        unsigned long long sum = 0, sumSquares = 0;
+        for (size_t r = row; r < row + rows; ++r) {
+            for (size_t c = col; c < col + cols; ++c) {
+                sum += plane(r, c);
+                sumSquares += plane(r, c) * plane(r, c);
+            }
+        }
+        ASSERT_EQ(sums.sum(row, col, rows, cols), sum);
+        ASSERT_EQ(squares.sum(row, col, rows, cols), sumSquares);
+    }
+    ASSERT_EQ(sums.total(), sums.sum(0, 0, plane.n_rows, plane.n_cols));
+    ASSERT_THROW(sums.sum(1, 0, plane.n_rows, 1), std::string);
+
+    Image im = { {{1, 9, 9}, {2, 9, 9}},
+                 {{3, 9, 9}, {4, 9, 9}} };
+    ASSERT_EQ(IntegralImage(im).total(), 10);
+    ASSERT_EQ(IntegralImage(Plane8()).total(), 0);
+}
+
+TEST(Matrix, BitMask) {
+    BitMask mask(3, 130);
+    ASSERT_EQ(mask.n_rows(), 3);
+    ASSERT_EQ(mask.n_cols(), 130);
+    mask.set(1, 0, true);
+    mask.set(1, 64, true);
+    mask.set(1, 129, true);
+    mask.set(2, 129, true);
+    mask.set(0, 5, true);
+    mask.set(0, 5, false);
+    ASSERT_TRUE(mask(1, 64));
+    ASSERT_FALSE(mask(0, 5));
+    ASSERT_EQ(mask.countRow(0), 0);
+    ASSERT_EQ(mask.countRow(1), 3);
+    ASSERT_EQ(mask.countColumn(129), 2);
+    ASSERT_EQ(mask.countColumn(1), 0);
+    ASSERT_EQ(mask.count(), 4);
+    ASSERT_THROW(mask.set(0, 130, true), std::string);
+}
+
+struct CountOp {
+    int operator () (const Matrix<int>& m) {
+        ++count;
+        return m(1, 1);
+    }
+
+    void merge(const CountOp& clone) {
+        count += clone.count;
+    }
+
+    size_t n_rows = 3, n_cols = 3;
+    size_t count = 0;
+};
+
+TEST(Matrix, ParallelUnaryMap) {
+    Matrix<int> m(300, 400);
+    for (size_t row = 0; row < m.n_rows; ++row) {
+        for (size_t col = 0; col < m.n_cols; ++col)
+            m(row, col) = rand() % 100;
+    }
+    auto seq = m.unary_map(SumOp(), ExecutionPolicy::SEQUENTIAL);
+    auto par = m.unary_map(SumOp(), ExecutionPolicy::PARALLEL);
+    ASSERT_TRUE(matrixIsEqual(seq, par));
+
+    CountOp counter;
+    auto copy = m.unary_map(counter);
+    ASSERT_EQ(counter.count, 298 * 398);
+    ASSERT_TRUE(matrixIsEqual(copy.submatrix(1, 1, 298, 398), m.submatrix(1, 1, 298, 398)));
+}
+
+struct DiffSumOp {
+    int operator () (const Matrix<int>& a, const Matrix<uint8_t>& b) const {
+        return SumOp()(a) - static_cast<int>(b(1, 1));
+    }
+
+    size_t n_rows = 3, n_cols = 3;
+};
+
+TEST(Matrix, BinaryMap) {
+    Matrix<int> a = { {1, 2, 3},
+                      {4, 5, 6},
+                      {7, 8, 9} };
+    Matrix<uint8_t> b = { {9, 8, 7},
+                          {6, 5, 4},
+                          {3, 2, 1} };
+
+    auto prod = binary_map([] (int x, uint8_t y) { return x * y; }, a, b);
+    ASSERT_TRUE(matrixIsEqual(prod, Matrix<int>({ {9, 16, 21}, {24, 25, 24}, {21, 16, 9} })));
+
+    auto sum = nary_map([] (int x, uint8_t y, int z) { return double(x + y + z); }, a, b, a);
+    ASSERT_EQ(sum(2, 0), 17.0);
+
+    auto stencil = binary_map(DiffSumOp(), a, b);
+    ASSERT_EQ(stencil(1, 1), 45 - 5);
+
+    ASSERT_THROW(binary_map([] (int x, int y) { return x + y; }, a, Matrix<int>(2, 3)), std::string);
+}
+
+static void writeLE(std::ofstream& out, uint64_t val, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i)
+        out.put(static_cast<char>((val >> (8 * i)) & 255));
+}
+
+// 8-bit BMP with gray palette.
+static void writeGrayBmp(const char* path, const Plane8& plane, bool topDown) {
+    size_t stride = (plane.n_cols + 3) / 4 * 4;
+    size_t offset = 54 + 4 * 256;
+    std::ofstream out(path, std::ios::binary);
+    out.put('B');
+    out.put('M');
+    writeLE(out, offset + stride * plane.n_rows, 4);
+    writeLE(out, 0, 4);
+    writeLE(out, offset, 4);
+    writeLE(out, 40, 4);
+    writeLE(out, plane.n_cols, 4);
+    writeLE(out, topDown ? -static_cast<int64_t>(plane.n_rows) : plane.n_rows, 4);
+    writeLE(out, 1, 2);
+    writeLE(out, 8, 2);
+    for (size_t i = 0; i < 6; ++i)
+        writeLE(out, 0, 4);
+    for (size_t i = 0; i < 256; ++i)
+        writeLE(out, i | (i << 8) | (i << 16), 4);
+    for (size_t i = 0; i < plane.n_rows; ++i) {
+        size_t row = topDown ? i : plane.n_rows - 1 - i;
+        for (size_t col = 0; col < stride; ++col)
+            out.put(col < plane.n_cols ? static_cast<char>(plane(row, col)) : 0);
+    }
+}
+
+TEST(IO, NativeBmpDecoder) {
+    srand(239);
+    const char* path = "native_decoder_test.bmp";
+    Image im(13, 7);
+    for (size_t row = 0; row < im.n_rows; ++row) {
+        for (size_t col = 0; col < im.n_cols; ++col)
+            im(row, col) = {rand() % 256, rand() % 256, rand() % 256};
+    }
+
+    save_image(im, path);
+    ASSERT_TRUE(imagesIsEqual(load_image(path), im));
+    ASSERT_TRUE(matrixIsEqual(load_plane(path, 1), extractPlane<uint8_t>(im, 1)));
+
+    BMP out;
+    out.SetSize(im.n_cols, im.n_rows);
+    out.SetBitDepth(32);
+    for (size_t row = 0; row < im.n_rows; ++row) {
+        for (size_t col = 0; col < im.n_cols; ++col) {
+            RGBApixel p;
+            p.Red = std::get<0>(im(row, col));
+            p.Green = std::get<1>(im(row, col));
+            p.Blue = std::get<2>(im(row, col));
+            p.Alpha = 0;
+            out.SetPixel(col, row, p);
+        }
+    }
+    out.WriteToFile(path);
+    ASSERT_TRUE(imagesIsEqual(load_image(path), im));
+    ASSERT_TRUE(imagesIsEqual(toImage(load_planar_image(path)), im));
+
+    Plane8 gray = extractPlane<uint8_t>(im, 0);
+    writeGrayBmp(path, gray, true);
+    Plane8 mapped = load_plane(path);
+    ASSERT_TRUE(matrixIsEqual(mapped, gray));
+    // rows of file with padding, nothing was copied.
+    ASSERT_EQ(mapped.row_stride(), 8);
+    ASSERT_EQ(std::get<1>(load_image(path)(3, 4)), gray(3, 4));
+
+    writeGrayBmp(path, gray, false);
+    ASSERT_TRUE(matrixIsEqual(load_plane(path, 2), gray));
+    ASSERT_TRUE(imagesIsEqual(load_image(path), toImage(PlanarImage8(gray, gray, gray))));
+
+    std::remove(path);
+}
+
+TEST(IO, BulkBmpWriter) {
+    srand(17);
+    const char* path = "bulk_writer_test.bmp";
+    PlanarImage8 im(11, 5);
+    for (size_t row = 0; row < im.n_rows(); ++row) {
+        for (size_t col = 0; col < im.n_cols(); ++col) {
+            im.red(row, col) = rand() % 256;
+            im.green(row, col) = rand() % 256;
+            im.blue(row, col) = rand() % 256;
+        }
+    }
+
+    save_image(im, path);
+    BMP in;
+    ASSERT_TRUE(in.ReadFromFile(path));
+    ASSERT_EQ(in.TellBitDepth(), 24);
+    ASSERT_EQ(in(4, 10)->Blue, im.blue(10, 4));
+    ASSERT_TRUE(imagesIsEqual(load_image(path), toImage(im)));
+
+    save_image(toImage(im), path);
+    ASSERT_TRUE(imagesIsEqual(load_image(path), toImage(im)));
+
+    save_plane(im.green, path);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    // header, gray palette and 11 rows of 8 bytes.
+    ASSERT_EQ(file.tellg(), 54 + 1024 + 11 * 8);
+    ASSERT_TRUE(in.ReadFromFile(path));
+    ASSERT_EQ(in.TellBitDepth(), 8);
+    ASSERT_TRUE(matrixIsEqual(load_plane(path), im.green));
+
+    std::remove(path);
+}
+
+TEST(IO, StreamingAlignment) {
+    srand(41);
+    const char* srcPath = "streaming_src_test.bmp";
+    const char* dstPath = "streaming_dst_test.bmp";
+    // random blocks, channels are shifted windows of it.
+    Plane8 scene(760, 760);
+    for (size_t row = 0; row < scene.n_rows; row += 8) {
+        for (size_t col = 0; col < scene.n_cols; col += 8) {
+            uint8_t val = rand() % 256;
+            for (size_t i = row; i < row + 8; ++i)
+                std::fill(scene.row_ptr(i) + col, scene.row_ptr(i) + col + 8, val);
+        }
+    }
+    const int offsets[3][2] = {{20, 33}, {30, 30}, {41, 22}};
+    Plane8 plate(3 * 700 + 1, 700);
+    for (size_t i = 0; i < 3; ++i) {
+        for (size_t row = 0; row < 700; ++row)
+            std::copy_n(scene.row_ptr(offsets[i][0] + row) + offsets[i][1], 700, plate.row_ptr(i * 700 + row));
+    }
+    save_plane(plate, srcPath);
+
+    // in-memory pipeline for big plates.
+    auto images = divideImageOnChannels(load_plane(srcPath));
+    std::vector<std::vector<Plane8>> pyramids;
+    for (const auto& image : images)
+        pyramids.push_back(getImagesPyramid(simpleCropImage(image, 0.04, 0.05), 0.5, 300, false));
+    ASSERT_EQ(pyramids[1].size(), 2);
+    auto shift0 = getBestShiftForPyramids(pyramids[1], pyramids[0], getBestShiftByMSE<uint8_t>, 30, 2, 0.5);
+    auto shift2 = getBestShiftForPyramids(pyramids[1], pyramids[2], getBestShiftByMSE<uint8_t>, 30, 2, 0.5);
+    ASSERT_EQ(shift0, std::make_pair(-10, 3));
+    ASSERT_EQ(shift2, std::make_pair(11, -8));
+    Image expected = toImage(mergeImages(images[1], images[0], images[2], shift0, shift2));
+
+    // coarse level is held in memory, full resolution is streamed by bands of 187 rows.
+    PlateShifts shifts = alignPlateStreaming(srcPath, dstPath, 1 << 17);
+    ASSERT_EQ(shifts.shift0, shift0);
+    ASSERT_EQ(shifts.shift2, shift2);
+    ASSERT_TRUE(imagesIsEqual(load_image(dstPath), expected));
+
+    // everything streamed.
+    shifts = alignPlateStreaming(srcPath, dstPath, 1 << 15);
+    ASSERT_EQ(shifts.shift0, shift0);
+    ASSERT_TRUE(imagesIsEqual(load_image(dstPath), expected));
+
+    // streamed result is BMP only.
+    ASSERT_THROW(alignPlateStreaming(srcPath, "streaming_result.tif"), std::string);
+
+    BmpReader reader(srcPath);
+    ASSERT_TRUE(matrixIsEqual(reader.read_rows(700, 5), plate.submatrix(700, 0, 5, 700).copy()));
+
+    std::remove(srcPath);
+    std::remove(dstPath);
+}
+
+TEST(IO, Tiff) {
+    srand(5);
+    const char* path = "tiff_test.tif";
+    PlanarImage16 im(37, 29);
+    for (size_t ch = 0; ch < 3; ++ch) {
+        for (size_t row = 0; row < im.n_rows(); ++row) {
+            for (size_t col = 0; col < im.n_cols(); ++col)
+                im.plane(ch)(row, col) = col < 10 ? 0x2020 : rand() % 65536;
+        }
+    }
+
+    for (bool packBits : {false, true}) {
+        save_tiff(im, path, packBits);
+        PlanarImage16 res = load_tiff(path);
+        for (size_t ch = 0; ch < 3; ++ch)
+            ASSERT_TRUE(matrixIsEqual(res.plane(ch), im.plane(ch)));
+        ASSERT_TRUE(matrixIsEqual(load_tiff_plane(path, 2), im.blue));
+
+        save_tiff(im.green, path, packBits);
+        ASSERT_TRUE(matrixIsEqual(load_tiff_plane(path), im.green));
+        ASSERT_TRUE(matrixIsEqual(load_tiff(path).red, im.green));
+    }
+
+    // big-endian 8-bit WhiteIsZero file with two strips.
+    const uint8_t data[] = {
+        'M', 'M', 0, 42, 0, 0, 0, 14,
+        10, 20, 30, 40, 50, 60,
+        0, 7,
+        1, 0, 0, 3, 0, 0, 0, 1, 0, 3, 0, 0,
+        1, 1, 0, 3, 0, 0, 0, 1, 0, 2, 0, 0,
+        1, 2, 0, 3, 0, 0, 0, 1, 0, 8, 0, 0,
+        1, 6, 0, 3, 0, 0, 0, 1, 0, 0, 0, 0,
+        1, 17, 0, 3, 0, 0, 0, 2, 0, 8, 0, 11,
+        1, 22, 0, 3, 0, 0, 0, 1, 0, 1, 0, 0,
+        1, 23, 0, 3, 0, 0, 0, 2, 0, 3, 0, 3,
+        0, 0, 0, 0};
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data), sizeof(data));
+    Plane16 plane = load_tiff_plane(path);
+    ASSERT_EQ(plane.n_rows, 2);
+    ASSERT_EQ(plane.n_cols, 3);
+    ASSERT_EQ(plane(0, 0), 245);
+    ASSERT_EQ(plane(1, 2), 195);
+
+    std::remove(path);
+}
+
+// Little-endian uncompressed 8-bit grayscale TIFF with one strip.
+static void saveTiff8(const Plane8& plane, const char* path) {
+    const uint32_t tags[][2] = {
+        {256, plane.n_cols}, {257, plane.n_rows}, {258, 8}, {259, 1}, {262, 1},
+        {273, 8 + 2 + 9 * 12 + 4}, {277, 1}, {278, plane.n_rows}, {279, plane.n_rows * plane.n_cols}};
+    std::vector<uint8_t> data = {'I', 'I', 42, 0, 8, 0, 0, 0, 9, 0};
+    for (const auto& tag : tags) {
+        const uint8_t entry[] = {uint8_t(tag[0]), uint8_t(tag[0] >> 8), 4, 0, 1, 0, 0, 0,
+                                 uint8_t(tag[1]), uint8_t(tag[1] >> 8), uint8_t(tag[1] >> 16), uint8_t(tag[1] >> 24)};
+        data.insert(data.end(), entry, entry + sizeof(entry));
+    }
+    data.insert(data.end(), 4, 0);
+    for (size_t row = 0; row < plane.n_rows; ++row)
+        data.insert(data.end(), plane.row_ptr(row), plane.row_ptr(row) + plane.n_cols);
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+TEST(IO, AlignTiff8) {
+    const char* path = "tiff8_test.tif";
+    Plane8 plate(390, 120);
+    for (size_t row = 0; row < plate.n_rows; ++row) {
+        for (size_t col = 0; col < plate.n_cols; ++col)
+            plate(row, col) = 30 + (row % 130 * 7 + col * 13 + row % 130 * col % 17) % 200;
+    }
+    saveTiff8(plate, path);
+    ASSERT_EQ(probe_image(path).bitsPerSample, 8);
+
+    // 8-bit scan gives the same result as the same plate from BMP.
+    Model fromTiff, fromPlane;
+    fromTiff.align(path, false, false, 1);
+    fromPlane.align(plate, false, false, 1);
+    Image res = fromTiff.getResultImage();
+    ASSERT_TRUE(imagesIsEqual(res, fromPlane.getResultImage()));
+    ASSERT_GT(std::get<0>(res(res.n_rows / 2, res.n_cols / 2)), 0);
+
+    std::remove(path);
+}
+
+TEST(Planar, Alignment16) {
+    Plane16 plane(4, 4);
+    for (size_t row = 0; row < 4; ++row) {
+        for (size_t col = 0; col < 4; ++col)
+            plane(row, col) = 60000 + 1000 * row + col;
+    }
+    // values are not clamped to 255.
+    Plane16 small = resize(plane, 0.5);
+    ASSERT_EQ(small(1, 1), plane(2, 2));
+    ASSERT_GT(resize(plane, 2.0)(7, 7), 60000);
+
+    PlanarImage16 merged = mergeImages(plane, plane, plane, {1, 0}, {0, -1});
+    ASSERT_EQ(merged.n_rows(), 3);
+    ASSERT_EQ(merged.n_cols(), 3);
+    ASSERT_EQ(merged.green(0, 0), plane(1, 0));
+    ASSERT_EQ(merged.blue(0, 0), plane(0, 0));
+    ASSERT_EQ(merged.red(0, 0), plane(1, 1));
+    ASSERT_EQ(getBestShiftByMSE(plane, plane, -1, 1, -1, 1), std::make_pair(0, 0));
+}
+
+TEST(IO, ProbeImage) {
+    const char* path = "probe_test.bmp";
+    Plane8 gray(9, 5);
+    save_plane(gray, path);
+    ImageInfo info = probe_image(path);
+    ASSERT_EQ(info.format, ImageFormat::BMP);
+    ASSERT_EQ(info.n_rows, 9);
+    ASSERT_EQ(info.n_cols, 5);
+    ASSERT_EQ(info.channels, 1);
+    ASSERT_EQ(info.decodedBytes(), 45);
+    ASSERT_TRUE(info.partialReads);
+
+    save_image(PlanarImage8(9, 5), path);
+    ASSERT_EQ(probe_image(path).channels, 3);
+
+    save_tiff(Plane16(9, 5), path);
+    info = probe_image(path);
+    ASSERT_EQ(info.format, ImageFormat::TIFF);
+    ASSERT_EQ(info.n_rows, 9);
+    ASSERT_EQ(info.bitsPerSample, 16);
+    ASSERT_EQ(info.planeBytes(), 90);
+    ASSERT_FALSE(info.partialReads);
+
+    std::remove(path);
+}
+
+TEST(IO, RegionOfInterest) {
+    srand(77);
+    const char* path = "roi_test.bmp";
+    Image im(31, 9);
+    for (size_t row = 0; row < im.n_rows; ++row) {
+        for (size_t col = 0; col < im.n_cols; ++col)
+            im(row, col) = {rand() % 256, rand() % 256, rand() % 256};
+    }
+
+    save_image(im, path);
+    ASSERT_TRUE(imagesIsEqual(load_image_roi(path, 4, 2, 11, 5), im.submatrix(4, 2, 11, 5).copy()));
+    ASSERT_TRUE(matrixIsEqual(load_plane_roi(path, 30, 0, 1, 9, 2), extractPlane<uint8_t>(im, 2).submatrix(30, 0, 1, 9).copy()));
+    ASSERT_THROW(load_image_roi(path, 30, 0, 2, 9), std::string);
+
+    Plane8 plate = extractPlane<uint8_t>(im, 1);
+    auto expected = divideImageOnChannels(plate);
+    for (bool topDown : {false, true}) {
+        writeGrayBmp(path, plate, topDown);
+        auto channels = loadPlateChannels(path);
+        ASSERT_EQ(channels.size(), 3);
+        for (size_t i = 0; i < 3; ++i)
+            ASSERT_TRUE(matrixIsEqual(channels[i], expected[i].copy()));
+    }
+    // thirds of top-down grayscale file are not copied.
+    ASSERT_EQ(loadPlateChannels(path)[1].row_stride(), 12);
+
+    // 16-bit file is read only by EasyBMP.
+    BMP out;
+    out.SetSize(im.n_cols, im.n_rows);
+    out.SetBitDepth(16);
+    for (size_t row = 0; row < im.n_rows; ++row) {
+        for (size_t col = 0; col < im.n_cols; ++col) {
+            RGBApixel p;
+            p.Red = p.Green = p.Blue = plate(row, col);
+            p.Alpha = 0;
+            out.SetPixel(col, row, p);
+        }
+    }
+    out.WriteToFile(path);
+    ASSERT_FALSE(probe_image(path).partialReads);
+    Plane8 decoded = load_plane(path);
+    auto roi = load_plane_roi(path, 3, 1, 20, 7);
+    ASSERT_TRUE(matrixIsEqual(roi, decoded.submatrix(3, 1, 20, 7).copy()));
+    ASSERT_TRUE(roi.is_contiguous());
+    expected = divideImageOnChannels(decoded);
+    auto channels = loadPlateChannels(path);
+    for (size_t i = 0; i < 3; ++i)
+        ASSERT_TRUE(matrixIsEqual(channels[i], expected[i].copy()));
+
+    std::remove(path);
+}
+
+TEST(Images, FFT) {
+    srand(3);
+    for (size_t n : {1, 12, 16, 21}) {
+        std::vector<std::complex<double>> data(n);
+        for (auto& val : data)
+            val = {rand() % 100 / 10.0, rand() % 100 / 10.0};
+        auto res = data;
+        fft(res);
+        for (size_t k = 0; k < n; ++k) {
+            std::complex<double> expected = 0;
+            for (size_t j = 0; j < n; ++j)
+                expected += data[j] * std::polar(1.0, -2 * M_PI * j * k / n);
+            ASSERT_LT(std::abs(res[k] - expected), 1e-9);
+        }
+        fft(res, true);
+        for (size_t k = 0; k < n; ++k)
+            ASSERT_LT(std::abs(res[k] - data[k]), 1e-9);
+    }
+
+    std::vector<std::complex<double>> image(6 * 10);
+    for (auto& val : image)
+        val = rand() % 256;
+    auto res = image;
+    fft2d(res, 6, 10);
+    ASSERT_LT(std::abs(res[0] - std::accumulate(image.begin(), image.end(), std::complex<double>(0))), 1e-9);
+    fft2d(res, 6, 10, true);
+    for (size_t i = 0; i < image.size(); ++i)
+        ASSERT_LT(std::abs(res[i] - image[i]), 1e-9);
+}
+
+TEST(Images, getBestShiftByPhaseCorrelation) {
+    srand(13);
+    Plane8 scene(150, 170);
+    for (size_t row = 0; row < scene.n_rows; row += 5) {
+        for (size_t col = 0; col < scene.n_cols; col += 5) {
+            uint8_t val = rand() % 256;
+            for (size_t i = row; i < row + 5; ++i)
+                std::fill(scene.row_ptr(i) + col, scene.row_ptr(i) + col + 5, val);
+        }
+    }
+    Plane8 image1 = scene.submatrix(20, 30, 100, 110).copy();
+    Plane8 image2 = scene.submatrix(27, 18, 100, 110).copy();
+    // image1(r, c) = image2(r - 7, c + 12).
+    auto shift = getBestShiftByPhaseCorrelation(image1, image2, -15, 15, -15, 15);
+    ASSERT_EQ(shift, std::make_pair(7, -12));
+    ASSERT_EQ(shift, getBestShiftByMSE(image1, image2, -15, 15, -15, 15));
+    // window far larger than shift, and not centered at it.
+    ASSERT_EQ(getBestShiftByPhaseCorrelation(image1, image2, -40, 40, -60, 0), shift);
+    ASSERT_EQ(getBestShiftByPhaseCorrelation(toImage(PlanarImage8(image1, image1, image1)),
+                                             toImage(PlanarImage8(image2, image2, image2)), -15, 15, -15, 15), shift);
+}